@@ -3,18 +3,63 @@
 #include <vector>
 #include <string>
 #include <format>
+#include <functional>
 #include <sstream>
-#include <map>
 #include <stack>
 #include <algorithm>
-
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <tuple>
+#include <unordered_map>
+#include <limits>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <deque>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <filesystem>
+#include <queue>
+#include <numeric>
+#include <cstring>
+#include <condition_variable>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define HAVE_SSE2 // every x86-64 CPU has it, so it's decided when compiling rather than checked at run time
+#endif
+
+#ifdef _WIN32
 #include <windows.h>
+#include <psapi.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <csignal>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+inline void DebugBreak()
+{
+	// what a failed test does away from Visual Studio: stop right there, in a debugger if there is one
+	std::raise(SIGTRAP);
+}
+#endif
 
 enum colour
 {
+	empty, // must be 0, so that an unfilled slot in a packed test_tube reads as empty
 	dark_blue,
 	dark_green,
-	empty,
 	light_blue,
 	light_green,
 	magenta,
@@ -92,16 +137,6 @@ public:
 	{}
 };
 
-class piece
-{
-public:
-	piece(coord position, colour colour) : position {position}, colour {colour}
-	{}
-	coord position {};
-	colour colour {empty};
-	void exchange_colours_with(piece& other) { std::swap(this->colour, other.colour); }
-};
-
 class move
 {
 public:
@@ -129,11 +164,46 @@ std::ostream& operator<<(std::ostream& out, const move& move)
 	return move.display(out);
 }
 
+// A move in two bytes, for the path and undo records of the in-place search.
+// There are at most 16 tubes and no tube holds more than 16, so each part fits in its own nibble or byte.
+class packed_move
+{
+public:
+	std::uint16_t bits {}; // from in the low 4 bits, to in the next 4, the size in the top 8. A size of 0 means no move at all.
+	packed_move()
+	{}
+	packed_move(const move& move) :
+		bits {static_cast<std::uint16_t>(move.from.tube_index | (move.to.tube_index << 4) | (move.move_size << 8))}
+	{}
+	bool is_a_move() const { return (bits >> 8) != 0; }
+	move unpack() const { return {static_cast<size_t>(bits & 0xFu), static_cast<size_t>((bits >> 4) & 0xFu), static_cast<size_t>(bits >> 8)}; }
+};
+
+// Everything needed to take a pour back off a board: the pour itself runs backwards, and the rest is put back as it was.
+class undo_record
+{
+public:
+	packed_move move;
+	packed_move previous_move; // the board's previous_move before the pour, if it had one
+	std::uint8_t sources_left {};
+	std::uint8_t destinations_left {};
+	std::uint64_t hash {};
+	std::uint64_t tube_order_free_hash {};
+};
+
 class solution
 {
 public:
 	solution(std::vector<move> moves) : moves {moves}
 	{}
+	solution(std::span<const packed_move> packed_moves)
+	{
+		moves.reserve(packed_moves.size());
+		for (const auto& packed_move : packed_moves)
+		{
+			moves.push_back(packed_move.unpack());
+		}
+	}
 	std::vector<move> moves;
 	std::ostream& display(std::ostream& dest) const
 	{
@@ -151,6 +221,32 @@ public:
 	}
 };
 
+// Called with each solution a streaming search finds, while the search is still on it. Each one is no longer than any before it,
+// so when one is shorter, the ones before it have been beaten. Return false to stop the search there.
+using solution_callback = std::function<bool(std::span<const packed_move> moves)>;
+
+// The shortest length a streaming search came to, and how many solutions of that length it came to. That's only the ones it reached:
+// the transposition table drops other paths of the same length, and the move order reductions drop other orders of the same pours,
+// so it can be far fewer than the level has, and how many depends on the options. shortest_solution_dag::count() is the level's count.
+class solution_count
+{
+public:
+	size_t length {};
+	std::uint64_t found {};
+};
+
+// What an anytime search has when it stops, whether it ran to the end or gave up on a limit.
+class anytime_solution
+{
+public:
+	std::optional<solution> best; // the shortest solution found, if any
+	bool proven_shortest {false}; // the search ran to the end, so nothing shorter than best exists (within max_solution_length)
+	std::uint64_t solutions_found {}; // how many solutions of best's length the search came to, which is fewer than the level has (see solution_count)
+	std::uint64_t shortest_solutions {}; // how many shortest solutions the level has, when they were counted: it came from a cache, or went into one
+	bool from_cache {false}; // best was looked up rather than searched for
+	std::string stopped_because; // empty when the search ran to the end
+};
+
 constexpr bool operator==(const solution& lhs, const solution& rhs)
 {
 	return lhs.moves == rhs.moves;
@@ -161,20 +257,45 @@ std::ostream& operator<<(std::ostream& out, const solution& solution)
 	return solution.display(out);
 }
 
+// A tube is packed into a single word, 4 bits per slot. Slot 0 (the bottom of the tube) is in the lowest bits.
+// Pieces always sit on top of each other, so the filled slots are the low nibbles and everything above them is 0 (empty).
+constexpr size_t bits_per_slot {4};
+constexpr std::uint64_t slot_mask {0xF};
+constexpr size_t max_tube_capacity {64 / bits_per_slot};
+constexpr size_t max_tube_count {16};
+
+constexpr std::uint64_t mask_of_slots(size_t slots)
+{
+	return slots >= max_tube_capacity ? ~std::uint64_t {0} : (std::uint64_t {1} << (slots * bits_per_slot)) - 1;
+}
+
+constexpr std::uint64_t colour_in_every_slot(colour colour)
+{
+	return static_cast<std::uint64_t>(colour) * 0x1111111111111111;
+}
+
 class test_tube
 {
 public:
-	std::vector<piece> contents; // index 0 is the bottom of the tube
-	size_t tube_id {};
+	std::uint64_t contents {}; // change it through set_contents or pour_into, so the summary below stays right
+	std::uint8_t tube_id {};
+	std::uint8_t capacity {};
+
+	// a summary of the contents, refreshed whenever they change, so checking a pour never has to look inside the word
+	colour top_colour {empty};
+	std::uint8_t top_run {};
+	std::uint8_t free_slots {};
+	bool finished {true}; // full of one colour, or empty
+	bool single_colour {false}; // not empty, and only one colour in it
 	std::ostream& display(std::ostream& dest) const
 	{
 		std::string tube {"{"};
-		for (auto i {0}; i < contents.size(); ++i)
+		for (size_t i {0}; i < capacity; ++i)
 		{
 			std::ostringstream ss;
-			ss << contents[i].colour;
+			ss << colour_at(i);
 			tube += ss.str();
-			if (i != contents.size() - 1)
+			if (i + 1 != capacity)
 			{
 				tube += ", ";
 			}
@@ -184,33 +305,41 @@ public:
 		return dest << tube;
 	}
 
-	test_tube(size_t tube_id, std::vector<colour> colours) : tube_id {tube_id}
+	test_tube()
+	{}
+	test_tube(size_t tube_id, std::vector<colour> colours) : tube_id {static_cast<std::uint8_t>(tube_id)}, capacity {static_cast<std::uint8_t>(colours.size())}
 	{
-		for (auto colour : colours)
+		if (colours.size() > max_tube_capacity)
 		{
-			contents.push_back({tube_id, colour});
+			throw std::runtime_error("this tube is too tall to pack");
 		}
-	}
-	colour pouring_colour()
-	{
-		for (auto back_iter {contents.rbegin()}; back_iter != contents.rend(); back_iter++)
+		for (size_t i {0}; i < colours.size(); ++i)
 		{
-			auto colour {back_iter->colour};
-			if (colour == empty)
-			{
-				continue;
-			}
-			else
+			if (colours[i] != empty && i != 0 && colours[i - 1] == empty)
 			{
-				return colour;
+				throw std::runtime_error("a colour can't float above an empty space");
 			}
+			contents |= static_cast<std::uint64_t>(colours[i]) << (i * bits_per_slot);
 		}
-
-		return empty;
+		refresh_summary();
+	}
+	void set_contents(std::uint64_t new_contents)
+	{
+		contents = new_contents;
+		refresh_summary();
 	}
-	bool is_empty() { return pouring_colour() == empty; }
-	bool has_an_empty_space() { return contents.back().colour == empty; }
-	bool can_pour_into(test_tube tube)
+	colour colour_at(size_t slot) const { return static_cast<colour>((contents >> (slot * bits_per_slot)) & slot_mask); }
+	size_t filled_slots() const { return (std::bit_width(contents) + bits_per_slot - 1) / bits_per_slot; }
+	colour pouring_colour() const { return top_colour; }
+	bool is_empty() const { return contents == 0; }
+	bool holds(colour colour) const
+	{
+		// a filled slot of that colour becomes a 0 nibble, and the slots above the filled ones are made not to, so look for a 0 nibble
+		auto differences {(contents ^ colour_in_every_slot(colour)) | ~mask_of_slots(filled_slots())};
+		return ((differences - 0x1111111111111111) & ~differences & 0x8888888888888888) != 0;
+	}
+	bool has_an_empty_space() const { return free_slots != 0; }
+	bool can_pour_into(const test_tube& tube) const
 	{
 		const bool has_space {tube.has_an_empty_space()};
 		const bool is_same_colour {tube.pouring_colour() == this->pouring_colour()};
@@ -220,60 +349,19 @@ public:
 
 		return has_space_for_my_colour || is_empty;
 	}
-	piece& piece(size_t piece_id) { return contents[piece_id]; }
-	size_t empty_spaces()
-	{
-		size_t empty_spaces {0};
-		for (auto back_iter {contents.rbegin()}; back_iter != contents.rend(); back_iter++)
-		{
-			if (back_iter->colour == empty)
-			{
-				++empty_spaces;
-			}
-			else
-			{
-				break;
-			}
-		}
-		return empty_spaces;
-	}
-	std::pair<colour, size_t> get_colour_and_depth()
+	size_t empty_spaces() const { return free_slots; }
+	std::pair<colour, size_t> get_colour_and_depth() const
 	{
-		// not interested in empty spots, only colours // maybe this could be used for empties too?
-		colour colour {empty};
-		size_t depth {};
-		for (auto back_iter {contents.rbegin()}; back_iter != contents.rend(); back_iter++)
-		{
-			if (back_iter->colour == empty) // haven't hit a colour yet
-			{
-				continue;
-			}
-			else if (depth == 0) // hit the first colour
-			{
-				colour = back_iter->colour;
-				depth++;
-			}
-			else if (back_iter->colour != colour) // hit a different colour
-			{
-				break;
-			}
-			else if (colour == back_iter->colour) // the next piece is the same colour
-			{
-				depth++;
-			}
-		}
-
-		if (colour == empty)
+		// not interested in empty spots, only colours
+		if (top_colour == empty)
 		{
 			throw std::runtime_error("you called the wrong function");
 		}
-
-		return {colour, depth};
+		return {top_colour, top_run};
 	}
-	move generate_move_to(test_tube destination)
+	move generate_move_to(const test_tube& destination) const
 	{
-		auto source {*this};
-		auto [source_colour, source_depth] {source.get_colour_and_depth()};
+		auto [source_colour, source_depth] {get_colour_and_depth()};
 		auto destination_depth {destination.empty_spaces()};
 
 		auto move_size {(std::min)(source_depth, destination_depth)};
@@ -282,39 +370,62 @@ public:
 			throw std::runtime_error("you did the wrong thing");
 		}
 
-		return {source.tube_id, destination.tube_id, move_size};
+		return {tube_id, destination.tube_id, move_size};
 	}
-	bool is_finished()
+	bool is_finished() const { return finished; }
+	bool is_single_colour() const
 	{
-		colour my_colour {contents.front().colour};
-		for (const auto& piece : contents)
+		if (is_empty())
 		{
-			if (piece.colour != my_colour)
-			{
-				return false;
-			}
+			throw std::runtime_error("for this function, empty is not a colour");
 		}
-		return true;
+		return single_colour;
 	}
-	bool is_single_colour()
+	size_t run_count() const
 	{
-		colour first_colour {contents.front().colour};
-		if (first_colour == empty)
+		// neighbouring slots xored together are 0 where they match, so count the non-zero slots below the top one
+		auto filled {filled_slots()};
+		if (filled == 0)
 		{
-			throw std::runtime_error("for this function, empty is not a colour");
+			return 0;
 		}
-		for (const auto& piece : contents)
+		auto changes {contents ^ (contents >> bits_per_slot)};
+		changes |= changes >> 1;
+		changes |= changes >> 2;
+		return 1 + std::popcount(changes & colour_in_every_slot(static_cast<colour>(1)) & mask_of_slots(filled - 1));
+	}
+	void pour_into(test_tube& destination, size_t move_size)
+	{
+		// lift the top move_size slots off this tube and drop them on top of the destination's contents
+		auto filled {filled_slots()};
+		auto remaining {filled - move_size};
+		auto poured {(contents >> (remaining * bits_per_slot)) & mask_of_slots(move_size)};
+		set_contents(contents & mask_of_slots(remaining));
+		destination.set_contents(destination.contents | (poured << (destination.filled_slots() * bits_per_slot)));
+	}
+private:
+	void refresh_summary()
+	{
+		auto filled {filled_slots()};
+		free_slots = static_cast<std::uint8_t>(capacity - filled);
+		if (filled == 0)
 		{
-			if (piece.colour == empty)
-			{
-				return true;
-			}
-			if (piece.colour != first_colour)
-			{
-				return false;
-			}
+			top_colour = empty;
+			top_run = 0;
+			finished = true;
+			single_colour = false;
+			return;
 		}
-		return true; // is_finished should be true here.
+
+		top_colour = colour_at(filled - 1);
+
+		// every slot that matches the top colour becomes 0, then line the top slot up with the top of the word and count down to the first mismatch.
+		auto differences {contents ^ (colour_in_every_slot(top_colour) & mask_of_slots(filled))};
+		auto aligned {differences << ((max_tube_capacity - filled) * bits_per_slot)};
+		top_run = static_cast<std::uint8_t>((std::min)(static_cast<size_t>(std::countl_zero(aligned)) / bits_per_slot, filled));
+
+		single_colour = top_run == filled;
+		finished = single_colour && free_slots == 0;
 	}
 };
 
@@ -323,763 +434,5977 @@ std::ostream& operator<<(std::ostream& out, const test_tube& tube)
 	return tube.display(out);
 }
 
-class game_state
+// Zobrist hashing: every (tube, slot, colour) has its own random key and a board's hash is the xor of the keys of its pieces,
+// so a pour only has to xor out the pieces it lifts and xor in the pieces it drops.
+constexpr size_t colours_per_slot {slot_mask + 1};
+
+constexpr std::uint64_t splitmix64(std::uint64_t& state)
 {
-public:
-	std::vector<move> possible_moves;
-	bool moves_have_been_generated {false};
-	std::vector<test_tube> test_tubes;
-	game_state(std::vector<std::vector<colour>> tubes)
+	auto z {state += 0x9e3779b97f4a7c15};
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+	return z ^ (z >> 31);
+}
+
+const std::vector<std::uint64_t> zobrist_keys {[] {
+	std::vector<std::uint64_t> keys(max_tube_count * max_tube_capacity * colours_per_slot);
+	std::uint64_t seed {0x5eed};
+	for (auto& key : keys)
 	{
-		for (const auto& tube : tubes)
-		{
-			test_tubes.push_back({test_tubes.size(), tube});
-			if (test_tubes.back().is_empty())
-			{
-				count_of_initial_empty_tubes++;
-			}
-		}
+		key = splitmix64(seed);
 	}
+	return keys;
+}()};
+
+std::uint64_t zobrist_key(size_t tube_index, size_t slot, colour colour)
+{
+	return colour == empty ? 0 : zobrist_keys[(tube_index * max_tube_capacity + slot) * colours_per_slot + colour];
+}
+
+class parent_dag;
+class pattern_database;
+class transposition_table;
+class shortest_solution_dag;
+class solution_cache;
+
+constexpr size_t user_defined_max_solution_length {100};
+
+class search_statistics
+{
+public:
+	std::uint64_t boards_generated {}; // every pour made
+	std::uint64_t boards_expanded {}; // every board whose own pours were searched
+	std::uint64_t transposition_hits {}; // boards dropped because they'd already been reached by a path at least as short
+	std::uint64_t transposition_reopens {}; // boards searched again because they'd been reached by a shorter path
+	std::uint64_t pruned_by_bound {}; // boards dropped because nothing below them could be as short as the shortest solution so far
+	std::uint64_t dead_ends {}; // unsolved boards with no pours
+	std::uint64_t solutions_found {};
+	size_t peak_depth {}; // the most pours on the path at once, which is the most boards on board_stack less one
+	size_t table_bytes {};
+	std::chrono::steady_clock::duration elapsed {};
 	std::ostream& display(std::ostream& dest) const
 	{
-		dest << "{";
-		for (auto i {0}; i < test_tubes.size(); ++i)
-		{
-			const auto& tube {test_tubes[i]};
-			dest << tube;
-			if (i != test_tubes.size() - 1)
-			{
-				dest << ", ";
-			}
-		}
-		dest << "}";
-
+		auto seconds {std::chrono::duration<double>(elapsed).count()};
+		dest << std::format("{:.1f}s: {} boards generated, {} expanded ({:.2f} M/s), {} transposition hits, {} reopens, {} pruned by bound, {} dead ends, {} solutions, peak depth {}, table {} MB",
+			seconds, boards_generated, boards_expanded, seconds > 0 ? boards_generated / seconds / 1e6 : 0.0, transposition_hits, transposition_reopens,
+			pruned_by_bound, dead_ends, solutions_found, peak_depth, table_bytes >> 20);
 		return dest;
 	}
+};
 
-	static std::vector<solution> work_out_all_solutions(game_state& given_state);
+std::ostream& operator<<(std::ostream& out, const search_statistics& statistics)
+{
+	return statistics.display(out);
+}
+
+// Lets another thread stop a search. The search notices at its next checkpoint, a few thousand boards later at most.
+class cancellation_token
+{
+public:
+	void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+	bool is_cancelled() const { return cancelled.load(std::memory_order_relaxed); }
 private:
-	game_state(const std::vector<test_tube>& test_tubes, size_t count_of_initial_empty_tubes) :
-		test_tubes {test_tubes}, count_of_initial_empty_tubes {count_of_initial_empty_tubes}
-	{}
-	bool is_finished {false};
-	size_t count_of_initial_empty_tubes {0};
-	std::vector<game_state> generate_possible_next_boards(std::vector<move> moves)
-	{
-		std::vector<game_state> next_boards;
-		for (const auto& move : moves)
-		{
-			next_boards.push_back(generate_new_board_from_move(move));
-		}
-		return next_boards;
-	}
-	void generate_possible_moves()
+	std::atomic<bool> cancelled {false};
+};
+
+struct search_options
+{
+	size_t transposition_table_bytes {0}; // 0 sizes it from the board, big enough for every board the level could reach, up to 256 MB
+	transposition_table* table {nullptr}; // when it's set, the depth-first searches clear it and use it rather than allocating their own
+	bool canonicalize_tubes {true}; // boards that only differ in the order of their tubes share a dedup key
+	bool canonicalize_colours {false}; // ...and so do boards that only differ in which colour is which. Costs a sort per board.
+	size_t max_solutions {std::numeric_limits<size_t>::max()}; // how many of the equally short solutions to hand back
+	size_t threads {0}; // for the parallel search. 0 is one per core.
+	bool reduce_move_orders {true}; // don't search pours that undo the last one, or independent pours in more than one order
+	bool take_safe_moves {false}; // the in-place search makes safe_move's pours without branching on them. It still finds a shortest solution, but not every one.
+	size_t max_solution_length {user_defined_max_solution_length}; // no search looks for anything longer than this
+	std::chrono::steady_clock::time_point deadline {std::chrono::steady_clock::time_point::max()}; // the searches give up with search_interrupted after this...
+	std::uint64_t max_boards_expanded {std::numeric_limits<std::uint64_t>::max()}; // ...or after expanding this many boards...
+	const cancellation_token* cancellation {nullptr}; // ...or when somebody cancels this
+	size_t memory_limit_bytes {size_t {1} << 30}; // caps the transposition table, and the breadth-first searches give up past it, so none of them can take the whole machine
+	const pattern_database* patterns {nullptr}; // when it's set, the depth-first searches cut boards it shows can't finish soon enough
+	solution_cache* cache {nullptr}; // when it's set, the anytime search looks the level up in it first, and adds what it proves
+	search_statistics* statistics {nullptr}; // the depth-first searches count into this when it's set
+	std::function<void(const search_statistics&)> on_progress; // called about every progress_interval while a depth-first search runs
+	std::chrono::milliseconds progress_interval {1000};
+};
+
+class search_interrupted : public std::runtime_error
+{
+public:
+	using std::runtime_error::runtime_error;
+};
+
+constexpr std::uint64_t mix64(std::uint64_t value)
+{
+	return splitmix64(value);
+}
+
+// A representative for all the boards that only differ in tube order and colour names.
+// Tubes are sorted by content, colours are renamed in order of first appearance, and that is repeated until it settles.
+// Equal canonical boards are always equivalent, so using one as a dedup key is safe even where two equivalent boards miss each other.
+class canonical_board
+{
+public:
+	std::array<std::uint64_t, max_tube_count> contents {};
+	std::array<std::uint8_t, max_tube_count> real_tube_index {}; // canonical position -> index of that tube in the real board
+	std::array<colour, colours_per_slot> real_colour {}; // canonical colour -> colour in the real board
+	std::array<std::uint8_t, max_tube_count> capacities {};
+	size_t tube_count {};
+	canonical_board(std::span<const test_tube> tubes) : tube_count {tubes.size()}
 	{
-		if (moves_have_been_generated)
+		std::array<std::uint64_t, max_tube_count> real_contents {};
+		std::array<std::uint64_t, max_tube_count> sort_keys {};
+		for (size_t i {0}; i < tube_count; ++i)
 		{
-			// because we're removing moves from the collection when we examine them, we want to make sure we don't generate moves for a board we've fully examined.
-			throw std::runtime_error("moves have already been generated");
+			real_contents[i] = tubes[i].contents;
+			real_tube_index[i] = static_cast<std::uint8_t>(i);
+
+			// start from an ordering that doesn't depend on colour names: each tube renamed on its own
+			std::array<std::uint8_t, colours_per_slot> own_names {};
+			sort_keys[i] = relabel(tubes[i].contents, own_names);
 		}
 
-		int finished_tubes {0};
-		for (auto& potential_source : test_tubes)
+		std::array<std::uint8_t, colours_per_slot> names {};
+		std::array<std::uint64_t, max_tube_count> previous_keys {};
+		for (size_t round {0}; round < 3; ++round)
 		{
-			if (potential_source.is_finished())
+			sort_by(sort_keys, real_contents);
+			names = {};
+			for (size_t i {0}; i < tube_count; ++i)
 			{
-				finished_tubes++;
-				if (finished_tubes == test_tubes.size() - count_of_initial_empty_tubes)
-				{
-					is_finished = true;
-				}
-				continue;
+				sort_keys[i] = relabel(real_contents[i], names);
 			}
-
-			if (potential_source.is_empty())
+			if (sort_keys == previous_keys)
 			{
-				continue;
+				break;
 			}
+			previous_keys = sort_keys;
+		}
+		sort_by(sort_keys, real_contents);
 
-			for (auto& potential_destination : test_tubes)
+		contents = sort_keys;
+		for (size_t i {0}; i < tube_count; ++i)
+		{
+			capacities[i] = tubes[real_tube_index[i]].capacity;
+		}
+		for (size_t c {1}; c < colours_per_slot; ++c)
+		{
+			if (names[c] != 0)
 			{
-				if (potential_source.tube_id == potential_destination.tube_id)
-				{
-					continue;
-				}
-
-				if (potential_source.is_single_colour() && potential_destination.is_empty())
-				{
-					continue;
-				}
-
-				if (potential_source.can_pour_into(potential_destination))
-				{
-					move m {potential_source.generate_move_to(potential_destination)};
-					possible_moves.push_back(m);
-				}
+				real_colour[names[c]] = static_cast<colour>(c);
 			}
 		}
-
-		moves_have_been_generated = true;
 	}
-	game_state generate_new_board_from_move(move m)
+	std::uint64_t hash() const
 	{
-		game_state new_board {this->test_tubes, this->count_of_initial_empty_tubes};
-		new_board.apply_move(m);
-		return new_board;
+		std::uint64_t hash {tube_count};
+		for (size_t i {0}; i < tube_count; ++i)
+		{
+			hash = mix64(hash ^ contents[i] ^ capacities[i]);
+		}
+		return hash;
 	}
-	void apply_move(move move)
+	move to_real_move(const move& canonical_move) const
 	{
-		auto& source {tube(move.from.tube_index)};
-		auto& dest {tube(move.to.tube_index)};
-		auto move_depth {move.move_size};
-
-		auto source_iter {source.contents.rbegin()};
-		auto dest_iter {dest.contents.begin()};
-		for (size_t move_count {0}; move_count < move_depth; ++move_count)
+		return {real_tube_index[canonical_move.from.tube_index], real_tube_index[canonical_move.to.tube_index], canonical_move.move_size};
+	}
+private:
+	static std::uint64_t relabel(std::uint64_t contents, std::array<std::uint8_t, colours_per_slot>& names)
+	{
+		// names[c] is the new name of colour c, 0 until it has been seen. Empty stays empty.
+		std::uint64_t renamed {0};
+		for (size_t slot {0}; slot < max_tube_capacity; ++slot)
 		{
-			// go down the source container and up the destination container (empty the source and fill the destination)
-			while (dest_iter->colour != empty)
+			auto c {(contents >> (slot * bits_per_slot)) & slot_mask};
+			if (c == empty)
 			{
-				dest_iter++;
+				break;
 			}
-
-			while (source_iter->colour == empty)
+			if (names[c] == 0)
 			{
-				source_iter++;
+				names[c] = static_cast<std::uint8_t>(1 + std::count_if(names.begin(), names.end(), [](auto name) { return name != 0; }));
+			}
+			renamed |= static_cast<std::uint64_t>(names[c]) << (slot * bits_per_slot);
+		}
+		return renamed;
+	}
+	void sort_by(std::array<std::uint64_t, max_tube_count>& keys, std::array<std::uint64_t, max_tube_count>& real_contents)
+	{
+		// insertion sort: there are never more than a handful of tubes, and the keys, real contents and indices must move together
+		for (size_t i {1}; i < tube_count; ++i)
+		{
+			for (size_t j {i}; j > 0 && std::tie(keys[j], real_contents[j]) < std::tie(keys[j - 1], real_contents[j - 1]); --j)
+			{
+				std::swap(keys[j], keys[j - 1]);
+				std::swap(real_contents[j], real_contents[j - 1]);
+				std::swap(real_tube_index[j], real_tube_index[j - 1]);
 			}
-
-			source_iter->exchange_colours_with(*dest_iter);
-			source_iter++;
-			dest_iter++;
 		}
 	}
-	test_tube& tube(size_t tube_id) { return test_tubes[tube_id]; }
 };
 
-std::ostream& operator<<(std::ostream& out, const game_state& state)
+template <typename function>
+decltype(auto) with_fixed_tube_count(size_t tube_count, function&& f)
 {
-	return state.display(out);
+	// Calls f with the tube count as a compile-time constant for the shapes most levels come in, and with 0 for the rest,
+	// which an engine takes to mean it reads the count from the board as it goes.
+	switch (tube_count)
+	{
+	case 5: return f(std::integral_constant<size_t, 5> {});
+	case 6: return f(std::integral_constant<size_t, 6> {});
+	case 7: return f(std::integral_constant<size_t, 7> {});
+	case 8: return f(std::integral_constant<size_t, 8> {});
+	case 9: return f(std::integral_constant<size_t, 9> {});
+	case 10: return f(std::integral_constant<size_t, 10> {});
+	case 11: return f(std::integral_constant<size_t, 11> {});
+	case 12: return f(std::integral_constant<size_t, 12> {});
+	case 13: return f(std::integral_constant<size_t, 13> {});
+	case 14: return f(std::integral_constant<size_t, 14> {});
+	case 15: return f(std::integral_constant<size_t, 15> {});
+	case 16: return f(std::integral_constant<size_t, 16> {});
+	default: return f(std::integral_constant<size_t, 0> {});
+	}
 }
 
-bool game_state_has_already_been_examined(std::map<std::string, size_t>& examined_boards, game_state& game_state, size_t length_of_path_to_state)
+class game_state
 {
-	std::ostringstream oss;
-	oss << game_state;
-	auto key {examined_boards.find(oss.str())};
-	if (key != examined_boards.end())
+public:
+	std::array<test_tube, max_tube_count> test_tubes; // only the first tube_count are in play, so a board never touches the heap
+	size_t tube_count {0};
+	std::uint64_t hash {0}; // kept up to date by apply_move
+	std::uint64_t tube_order_free_hash {0}; // the same for every ordering of the same tubes, also kept up to date by apply_move
+	// where next_possible_move carries on from: it walks the sources from the last tube down, and for each source the destinations from the last tube down
+	std::uint8_t sources_left {0};
+	std::uint8_t destinations_left {0};
+	// every tube's top colour and free slots side by side, copied from the tubes' summaries whenever they change,
+	// so legal_destinations can compare one tube against all of them at once
+	alignas(16) std::array<std::uint8_t, max_tube_count> top_colours {};
+	alignas(16) std::array<std::uint8_t, max_tube_count> free_slots {};
+	game_state(std::vector<std::vector<colour>> tubes)
 	{
-		if (length_of_path_to_state < key->second)
+		if (tubes.size() > max_tube_count)
 		{
-			key->second = length_of_path_to_state;
-			return false;
+			throw std::runtime_error("too many tubes");
 		}
-		else
+		for (const auto& tube : tubes)
 		{
-			return true;
+			test_tubes[tube_count] = {tube_count, tube};
+			tube_count++;
 		}
+		rehash();
+		refresh_lanes();
+		restart_move_generation();
 	}
-	else
+	static game_state from_packed_tubes(std::span<const std::uint8_t> capacities, std::span<const std::uint64_t> contents)
 	{
-		examined_boards[oss.str()] = length_of_path_to_state;
-		return false;
+		// the same as the constructor from colours, but straight from tubes packed the way test_tube keeps them, without a vector in sight
+		std::array<test_tube, max_tube_count> tubes {};
+		for (size_t i {0}; i < capacities.size(); ++i)
+		{
+			tubes[i].tube_id = static_cast<std::uint8_t>(i);
+			tubes[i].capacity = capacities[i];
+			tubes[i].set_contents(contents[i]);
+		}
+		game_state board {tubes, capacities.size(), 0, 0};
+		board.rehash();
+		return board;
 	}
-}
-
-std::vector<solution> game_state::work_out_all_solutions(game_state& given_state)
-{
-	// iterative depth-first search
-	// This will find and return all of the equal shortest solutions.
-
-	constexpr size_t user_defined_max_solution_length {100};
-	size_t length_of_shortest_solution_so_far {user_defined_max_solution_length};
-
-	std::vector<solution> solutions;
-	std::vector<move> possible_solution;
-	std::map<std::string, size_t> examined_boards;
-	std::stack<game_state> board_stack;
-
-	given_state.generate_possible_moves();
-	if (given_state.is_finished)
+	std::span<test_tube> tubes() { return {test_tubes.data(), tube_count}; }
+	std::span<const test_tube> tubes() const { return {test_tubes.data(), tube_count}; }
+	canonical_board canonical_form() const { return {tubes()}; }
+	std::uint64_t dedup_key(const search_options& options) const
 	{
-		throw std::runtime_error("this state is already solved");
+		if (options.canonicalize_colours)
+		{
+			return canonical_form().hash();
+		}
+		return options.canonicalize_tubes ? tube_order_free_hash : hash;
 	}
-
-	static_cast<void>(game_state_has_already_been_examined(examined_boards, given_state, possible_solution.size()));
-	board_stack.push(given_state);
-
-	while (!board_stack.empty())
+	template <size_t fixed_tube_count = 0>
+	bool is_solved() const
 	{
-		bool this_board_generated_a_solution {false};
-		bool must_examine_child_state {false};
-		auto& state_to_examine {board_stack.top()};
-
-		if (board_stack.size() > user_defined_max_solution_length ||
-			board_stack.size() > length_of_shortest_solution_so_far) //gt, not geq because there will always be one more state in the stack than moves in the potential solution, due to the initial state
+		for (size_t i {0}; i < tubes_in_play<fixed_tube_count>(); ++i)
 		{
-			state_to_examine.possible_moves.clear(); // and the horse you rode in on
-			// just clear all moves as an easy way to say that we're done with this state. Then we fall nicely into the stack-popping section below the while.
+			if (!test_tubes[i].is_finished())
+			{
+				return false;
+			}
 		}
-
-		while (!state_to_examine.possible_moves.empty())
+		return true;
+	}
+	template <size_t fixed_tube_count = 0>
+	std::optional<move> safe_move(colour colour) const
+	{
+		// A pour of this colour that never makes the shortest solution any longer, so a search can make it without trying anything else:
+		// every piece of the colour is in two tubes that hold nothing else, and one is exactly as empty as the other is full.
+		// Every solution has to bring those pieces together at some point, and until it does, neither tube can take anything
+		// but that colour, so doing it first leaves a finished tube, and an empty one to stand in for whichever of the two
+		// a solution went on to use for something else. That needs every tube to be the same size.
+		if (std::popcount(tubes_topped_with(colour)) < 2)
 		{
-			auto move_to_examine {state_to_examine.possible_moves.back()}; // arbitrarily choose the last one
-			// possible_solution.push_back(move_to_examine); // the move stays in the possible solution until all of its children have been examined.
-			state_to_examine.possible_moves.pop_back(); // take the move off the game_state so it's not examined again.
-
-			auto new_board {state_to_examine.generate_new_board_from_move(move_to_examine)};
-			new_board.generate_possible_moves();
-			if (new_board.is_finished)
+			return std::nullopt; // the quick answer, and nearly always the answer
+		}
+		std::array<size_t, 2> holders {};
+		size_t holder_count {0};
+		for (size_t i {0}; i < tubes_in_play<fixed_tube_count>(); ++i)
+		{
+			if (test_tubes[i].capacity != test_tubes[0].capacity)
 			{
-				possible_solution.push_back(move_to_examine); // add the move to get to the solution so we can copy it off
-
-				if (possible_solution.size() < length_of_shortest_solution_so_far)
+				return std::nullopt;
+			}
+			if (test_tubes[i].holds(colour))
+			{
+				if (holder_count == holders.size() || !test_tubes[i].single_colour)
 				{
-					solutions.clear(); // I don't care about the millions of slightly less efficient solutions. Just take the shortest or those equal to the shortest.
-					length_of_shortest_solution_so_far = possible_solution.size();
+					return std::nullopt;
 				}
-
-				solutions.push_back(possible_solution);
-				possible_solution.pop_back(); // we're looking for all solutions, so take the winning move back off the list because we want to continue on our search.
-
-				// since this is a depth first search, if state_to_examine can generate any other solutions, they must be at least as long as this one or longer.
-				// we're going to examine the rest of this state's moves, for all solutions of equally short length, but we won't examine any further down the tree.
-				this_board_generated_a_solution = true;
+				holders[holder_count++] = i;
 			}
-			else if (new_board.possible_moves.size() == 0)
+		}
+		if (holder_count != holders.size())
+		{
+			return std::nullopt;
+		}
+		const auto& first {test_tubes[holders[0]]};
+		const auto& second {test_tubes[holders[1]]};
+		if (first.finished || second.finished || first.top_run != second.free_slots)
+		{
+			return std::nullopt;
+		}
+		return first.generate_move_to(second);
+	}
+	std::uint16_t legal_destinations(size_t source) const
+	{
+		// Bit d is set when the source can pour into tube d: d has room and the same colour on top, or d is empty.
+		// Pouring a tube of one colour into an empty tube only moves it, so that's left out, as is the source itself.
+		// The source mustn't be finished (which includes empty).
+#ifdef HAVE_SSE2
+		const auto colours {_mm_load_si128(reinterpret_cast<const __m128i*>(top_colours.data()))};
+		const auto spaces {_mm_load_si128(reinterpret_cast<const __m128i*>(free_slots.data()))};
+		const auto zero {_mm_setzero_si128()};
+		const auto same_colour {_mm_cmpeq_epi8(colours, _mm_set1_epi8(static_cast<char>(top_colours[source])))};
+		const auto full {_mm_cmpeq_epi8(spaces, zero)};
+		auto legal {_mm_andnot_si128(full, same_colour)};
+		if (!test_tubes[source].single_colour)
+		{
+			legal = _mm_or_si128(legal, _mm_cmpeq_epi8(colours, zero));
+		}
+		auto destinations {static_cast<std::uint16_t>(_mm_movemask_epi8(legal))};
+#else
+		auto destinations {legal_destinations_one_by_one(source)};
+#endif
+		return destinations & static_cast<std::uint16_t>(((1u << tube_count) - 1) & ~(1u << source));
+	}
+	std::uint16_t tubes_topped_with(colour colour) const
+	{
+		// bit t is set when tube t has that colour on top
+#ifdef HAVE_SSE2
+		const auto colours {_mm_load_si128(reinterpret_cast<const __m128i*>(top_colours.data()))};
+		auto tubes {static_cast<std::uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(colours, _mm_set1_epi8(static_cast<char>(colour)))))};
+#else
+		std::uint16_t tubes {0};
+		for (size_t t {0}; t < tube_count; ++t)
+		{
+			tubes |= static_cast<std::uint16_t>((top_colours[t] == colour) << t);
+		}
+#endif
+		return tubes & static_cast<std::uint16_t>((1u << tube_count) - 1);
+	}
+	std::uint16_t legal_destinations_one_by_one(size_t source) const
+	{
+		// what legal_destinations works out, one tube at a time, for when there's no SSE2
+		std::uint16_t destinations {0};
+		for (size_t d {0}; d < tube_count; ++d)
+		{
+			const bool same_colour_with_room {top_colours[d] == top_colours[source] && free_slots[d] != 0};
+			const bool empty_and_worth_it {top_colours[d] == empty && !test_tubes[source].single_colour};
+			if (d != source && (same_colour_with_room || empty_and_worth_it))
 			{
-				// this board has no possible moves, and it's not finished, it's a loser.
+				destinations |= static_cast<std::uint16_t>(1u << d);
 			}
-			else if (game_state_has_already_been_examined(examined_boards, new_board, possible_solution.size() + 1)) // +1 for the size the solution would be if we included this move
+		}
+		return destinations;
+	}
+	size_t lower_bound_on_moves_left() const
+	{
+		// A pour can only take one run off the top of its source, and at best lands it on a run of the same colour,
+		// so each pour merges at most two runs into one, and it takes at least the runs there are now less the runs there are when solved.
+		// That needs the most runs a solved board could have: a colour fills whole tubes, so no more of them than its pieces fill,
+		// smallest first, and no more tubes than there are. With every tube the same height, that's the tubes each colour fills.
+		size_t runs {0};
+		std::array<size_t, colours_per_slot> pieces {};
+		std::array<size_t, max_tube_count> capacities {};
+		for (size_t i {0}; i < tube_count; ++i)
+		{
+			const auto& tube {test_tubes[i]};
+			runs += tube.run_count();
+			capacities[i] = tube.capacity;
+			for (size_t slot {0}; slot < tube.filled_slots(); ++slot)
 			{
-				// this check is really to stop us cycling endlessly between the same game states.
-				// It also stops us checking a state if we've already seen a shorter path to it.
-
-				// I'm ok with keeping this check after the check for 0 moves, because we're already not going to examine this state further, 
-				// so we don't gain anything in adding it to the examined_boards collection.
-
-				// I'm ok with not adding solved states to the collection of examined states, as we don't gain anything in doing so, 
-				// since we're not examining further down the tree once we've found a solution.
-
-				// if we don't store the path length to a state with the state, when got to a state through a long path, 
-				// we'd neglect to examine that same state if we reached it through a shorter path, 
-				// denying ourselves the opportunity to consider a potentially shorter solution.
+				pieces[tube.colour_at(slot)]++;
 			}
-			else
+		}
+		std::sort(capacities.begin(), capacities.begin() + tube_count);
+		size_t most_runs_when_solved {0};
+		for (auto count : pieces)
+		{
+			for (size_t i {0}; i < tube_count && capacities[i] <= count; ++i)
 			{
-				if (this_board_generated_a_solution)
+				count -= capacities[i];
+				most_runs_when_solved++;
+			}
+		}
+		most_runs_when_solved = (std::min)(most_runs_when_solved, tube_count);
+		return runs > most_runs_when_solved ? runs - most_runs_when_solved : 0;
+	}
+	double board_count_bound() const
+	{
+		// Pours never change the pieces, so no search of this level can see more boards than there are ways to share the pieces
+		// out among the tubes (how full each tube is) and colour them in. It's loose, but tight enough to tell a small level from a big one.
+		std::array<size_t, colours_per_slot> pieces {};
+		size_t filled {0};
+		std::vector<double> ways_to_fill(1, 1.0); // [n] is how many ways the tubes so far can hold n pieces between them
+		for (const auto& tube : tubes())
+		{
+			for (size_t slot {0}; slot < tube.filled_slots(); ++slot)
+			{
+				pieces[tube.colour_at(slot)]++;
+			}
+			filled += tube.filled_slots();
+			std::vector<double> with_this_tube(ways_to_fill.size() + tube.capacity, 0.0);
+			for (size_t n {0}; n < ways_to_fill.size(); ++n)
+			{
+				for (size_t k {0}; k <= tube.capacity; ++k)
 				{
-					continue;
+					with_this_tube[n + k] += ways_to_fill[n];
 				}
-				else
-				{
-					possible_solution.push_back(move_to_examine);
-					board_stack.push(new_board);
+			}
+			ways_to_fill = std::move(with_this_tube);
+		}
+		auto log_colourings {std::lgamma(filled + 1.0)};
+		for (auto count : pieces)
+		{
+			log_colourings -= std::lgamma(count + 1.0);
+		}
+		return ways_to_fill[filled] * std::exp(log_colourings); // infinity for a big enough level, which is fine for comparing
+	}
+	bool is_solved_by(const solution& solution) const
+	{
+		// replays the moves, checking that each one is a legal pour of exactly the size the game would pour
+		auto board {fresh_copy()};
+		for (const auto& move : solution.moves)
+		{
+			if (move.from.tube_index >= tube_count || move.to.tube_index >= tube_count || move.from.tube_index == move.to.tube_index)
+			{
+				return false;
+			}
+			const auto& source {board.tube(move.from.tube_index)};
+			const auto& destination {board.tube(move.to.tube_index)};
+			if (source.is_empty() || !destination.has_an_empty_space() || !source.can_pour_into(destination) || !(source.generate_move_to(destination) == move))
+			{
+				return false;
+			}
+			board.apply_move(move);
+		}
+		return board.is_solved();
+	}
+	std::ostream& display(std::ostream& dest) const
+	{
+		dest << "{";
+		for (size_t i {0}; i < tube_count; ++i)
+		{
+			const auto& tube {test_tubes[i]};
+			dest << tube;
+			if (i != tube_count - 1)
+			{
+				dest << ", ";
+			}
+		}
+		dest << "}";
 
-					// if state_to_examine has no more moves (because we were the last examined), 
-					// we must be careful to not immediately pop the board we just pushed.
-					must_examine_child_state = true;
+		return dest;
+	}
 
-					break; // we stop examining the moves of this board and start examining the new board
-				}
-			}
+	static std::vector<solution> work_out_all_solutions(game_state& given_state, const search_options& options = {});
+	static void stream_solutions_in_place(const game_state& given_state, const search_options& options, const solution_callback& on_solution);
+	template <size_t fixed_tube_count>
+	static void stream_solutions_in_place_for(const game_state& given_state, const search_options& options, const solution_callback& on_solution);
+	static std::vector<solution> work_out_all_solutions_in_place(const game_state& given_state, const search_options& options = {});
+	static std::optional<solution> work_out_first_solution_in_place(const game_state& given_state, const search_options& options = {});
+	static solution_count count_solutions_found_in_place(const game_state& given_state, const search_options& options = {});
+	static anytime_solution work_out_best_solution_anytime(const game_state& given_state, const search_options& options = {});
+	static std::uint64_t count_shortest_solutions(const game_state& given_state, const search_options& options, size_t length);
+	static std::vector<solution> work_out_shortest_solutions_breadth_first(const game_state& given_state, const search_options& options = {});
+	static shortest_solution_dag work_out_shortest_solution_dag(const game_state& given_state, const search_options& options = {});
+	static std::vector<solution> work_out_shortest_solutions_breadth_first_in_parallel(const game_state& given_state, const search_options& options = {});
+	static shortest_solution_dag work_out_shortest_solution_dag_in_parallel(const game_state& given_state, const search_options& options = {});
+	static solution rebuild_solution(const parent_dag& dag, const game_state& given_state, const search_options& options, std::uint64_t index);
+	static std::vector<solution> work_out_shortest_solutions_iterative_deepening(const game_state& given_state, const search_options& options = {});
+	static std::optional<size_t> work_out_shortest_length_externally(const game_state& given_state, const std::filesystem::path& work_directory, const search_options& options = {});
+	static std::vector<solution> work_out_all_solutions_in_parallel(const game_state& given_state, const search_options& options = {});
+
+	template <size_t fixed_tube_count = 0>
+	undo_record make_move(const move& move)
+	{
+		// pours on this board rather than a copy of it, and leaves it ready to hand out the new board's moves
+		undo_record undo {move, previous_move ? packed_move {*previous_move} : packed_move {}, sources_left, destinations_left, hash, tube_order_free_hash};
+		apply_move(move);
+		previous_move = move;
+		restart_move_generation<fixed_tube_count>();
+		return undo;
+	}
+	void unmake_move(const undo_record& undo)
+	{
+		auto move {undo.move.unpack()};
+		tube(move.to.tube_index).pour_into(tube(move.from.tube_index), move.move_size); // pouring never looks at what it lands on, so it runs backwards just as well
+		refresh_lane(move.from.tube_index);
+		refresh_lane(move.to.tube_index);
+		previous_move = undo.previous_move.is_a_move() ? std::optional {undo.previous_move.unpack()} : std::nullopt;
+		sources_left = undo.sources_left;
+		destinations_left = undo.destinations_left;
+		hash = undo.hash;
+		tube_order_free_hash = undo.tube_order_free_hash;
+	}
+private:
+	game_state(const std::array<test_tube, max_tube_count>& test_tubes, size_t tube_count, std::uint64_t hash, std::uint64_t tube_order_free_hash) :
+		test_tubes {test_tubes}, tube_count {tube_count}, hash {hash}, tube_order_free_hash {tube_order_free_hash}
+	{
+		refresh_lanes();
+		restart_move_generation();
+	}
+	template <size_t fixed_tube_count = 0>
+	size_t tubes_in_play() const
+	{
+		// an engine built for one shape passes its tube count in, so the loops over the tubes have a bound the compiler knows.
+		// 0 is the engine that reads it from the board.
+		if constexpr (fixed_tube_count != 0)
+		{
+			return fixed_tube_count;
 		}
-		if (state_to_examine.possible_moves.empty() && !must_examine_child_state)
+		else
 		{
-			board_stack.pop();
-			if (!board_stack.empty())
+			return tube_count;
+		}
+	}
+	template <size_t fixed_tube_count = 0>
+	void restart_move_generation()
+	{
+		sources_left = static_cast<std::uint8_t>(tubes_in_play<fixed_tube_count>());
+		destinations_left = static_cast<std::uint8_t>(tubes_in_play<fixed_tube_count>());
+	}
+	static std::uint64_t tube_hash(const test_tube& tube)
+	{
+		// summed over the tubes, so it has to be well mixed on its own
+		return mix64(tube.contents ^ (static_cast<std::uint64_t>(tube.capacity) << 56));
+	}
+	void rehash()
+	{
+		hash = 0;
+		tube_order_free_hash = 0;
+		for (size_t i {0}; i < tube_count; ++i)
+		{
+			const auto& tube {test_tubes[i]};
+			for (size_t slot {0}; slot < tube.capacity; ++slot)
 			{
-				possible_solution.pop_back(); // if we've finished with a board, we've finished with the move that lead to it
+				hash ^= zobrist_key(i, slot, tube.colour_at(slot));
 			}
-			else
+			tube_order_free_hash += tube_hash(tube);
+		}
+	}
+	game_state fresh_copy() const { return {test_tubes, tube_count, hash, tube_order_free_hash}; } // no moves generated yet
+	game_state with_contents(std::span<const std::uint64_t> contents) const
+	{
+		// the same tubes (ids and capacities) with different pieces in them, and no moves generated yet
+		game_state board {test_tubes, tube_count, 0, 0};
+		for (size_t i {0}; i < tube_count; ++i)
+		{
+			board.test_tubes[i].set_contents(contents[i]);
+		}
+		board.rehash();
+		board.refresh_lanes();
+		return board;
+	}
+	static std::array<std::uint8_t, max_tube_count> match_tubes(const game_state& from_board, const game_state& to_board)
+	{
+		// both boards have the same canonical form, so a tube in one lines up with the tube in the same canonical position in the other.
+		// Equivalent boards don't always have the same canonical form, but two boards with the same dedup key always do.
+		canonical_board from {from_board.tubes()};
+		canonical_board to {to_board.tubes()};
+		std::array<std::uint8_t, max_tube_count> tube_in_to_board {};
+		for (size_t k {0}; k < from.tube_count; ++k)
+		{
+			tube_in_to_board[from.real_tube_index[k]] = to.real_tube_index[k];
+		}
+		return tube_in_to_board;
+	}
+	static parent_dag work_out_parent_dag(const game_state& given_state, const search_options& options);
+	static parent_dag work_out_parent_dag_in_parallel(const game_state& given_state, const search_options& options);
+	static std::vector<solution> rebuild_solutions(const parent_dag& dag, const game_state& given_state, const search_options& options);
+	static solution replay(const parent_dag& dag, const game_state& given_state, const search_options& options, std::span<const std::uint32_t> reversed_edges);
+	std::optional<move> previous_move; // the pour that made this board, if it was made by one
+	std::vector<game_state> generate_possible_next_boards(std::vector<move> moves)
+	{
+		std::vector<game_state> next_boards;
+		for (const auto& move : moves)
+		{
+			next_boards.push_back(generate_new_board_from_move(move));
+		}
+		return next_boards;
+	}
+	template <size_t fixed_tube_count = 0>
+	std::optional<move> next_possible_move(bool skip_redundant_orders = true)
+	{
+		// Hands out this board's moves one at a time, so a search that cuts a board off early never pays for the moves it didn't look at.
+		// All of a source's legal destinations come out of legal_destinations at once, and only those are visited, highest first.
+		while (sources_left != 0)
+		{
+			const size_t source {sources_left - 1u};
+			const auto& potential_source {test_tubes[source]};
+			if (!potential_source.is_finished()) // an empty tube counts as finished too
 			{
-				// The initial game state wasn't generated by applying a move from a previous board, so we can't pop it off 
+				auto destinations {legal_destinations(source) & ((1u << destinations_left) - 1)};
+				while (destinations != 0)
+				{
+					const auto destination {static_cast<std::uint8_t>(std::bit_width(destinations) - 1)};
+					destinations &= ~(1u << destination);
+					destinations_left = destination;
+
+					if (skip_redundant_orders && previous_move && is_redundant_after(*previous_move, source, destination))
+					{
+						continue;
+					}
+					return potential_source.generate_move_to(test_tubes[destination]);
+				}
 			}
+			sources_left--;
+			destinations_left = static_cast<std::uint8_t>(tubes_in_play<fixed_tube_count>());
 		}
+		return std::nullopt;
 	}
-	return solutions;
+	template <size_t fixed_tube_count = 0>
+	bool has_a_possible_move(bool skip_redundant_orders = true)
+	{
+		// looks ahead, then puts the generator back where it was
+		auto sources {sources_left};
+		auto destinations {destinations_left};
+		bool found {next_possible_move<fixed_tube_count>(skip_redundant_orders).has_value()};
+		sources_left = sources;
+		destinations_left = destinations;
+		return found;
+	}
+	void stop_generating_moves()
+	{
+		sources_left = 0;
+	}
+	game_state generate_new_board_from_move(move m)
+	{
+		game_state new_board {this->test_tubes, this->tube_count, this->hash, this->tube_order_free_hash};
+		new_board.apply_move(m);
+		new_board.previous_move = m;
+		return new_board;
+	}
+	static bool is_redundant_after(const move& previous, size_t from, size_t to)
+	{
+		// Pouring straight back the way the last pour came always lands on a board that is one pour (or no pours) from the board before it,
+		// so it can never be part of a shortest solution.
+		if (from == previous.to.tube_index && to == previous.from.tube_index)
+		{
+			return true;
+		}
+
+		// Two pours between four different tubes don't affect each other, so they give the same board in either order.
+		// Only the order with the lower tubes first is searched; the other order is generated from the board before.
+		const bool independent {from != previous.from.tube_index && from != previous.to.tube_index && to != previous.from.tube_index && to != previous.to.tube_index};
+		return independent && std::pair {from, to} < std::pair {previous.from.tube_index, previous.to.tube_index};
+	}
+	void apply_move(move move)
+	{
+		auto& source {tube(move.from.tube_index)};
+		auto& dest {tube(move.to.tube_index)};
+		auto colour {source.pouring_colour()};
+		auto source_top {source.filled_slots()};
+		auto dest_top {dest.filled_slots()};
+		for (size_t i {0}; i < move.move_size; ++i)
+		{
+			hash ^= zobrist_key(move.from.tube_index, source_top - 1 - i, colour);
+			hash ^= zobrist_key(move.to.tube_index, dest_top + i, colour);
+		}
+
+		tube_order_free_hash -= tube_hash(source) + tube_hash(dest);
+		source.pour_into(dest, move.move_size);
+		tube_order_free_hash += tube_hash(source) + tube_hash(dest);
+		refresh_lane(move.from.tube_index);
+		refresh_lane(move.to.tube_index);
+	}
+	void refresh_lane(size_t tube_index)
+	{
+		top_colours[tube_index] = static_cast<std::uint8_t>(test_tubes[tube_index].top_colour);
+		free_slots[tube_index] = test_tubes[tube_index].free_slots;
+	}
+	void refresh_lanes()
+	{
+		for (size_t i {0}; i < tube_count; ++i)
+		{
+			refresh_lane(i);
+		}
+	}
+	test_tube& tube(size_t tube_id) { return test_tubes[tube_id]; }
+};
+
+std::ostream& operator<<(std::ostream& out, const game_state& state)
+{
+	return state.display(out);
 }
 
-solution& work_out_best_solution(std::vector<solution>& solutions)
+// A file mapped read-only into memory, so a layer on disk can be read like an array without reading it in first.
+// The pages are the operating system's to keep or drop, so they don't count against a search's memory.
+class mapped_file
 {
-	size_t index_of_best_solution {};
-	size_t shortest_solution_length_so_far {};
-	for (size_t i {0}; i < solutions.size(); i++)
+public:
+	mapped_file(const std::filesystem::path& path, bool read_in_order = true) : bytes {static_cast<size_t>(std::filesystem::file_size(path))}
 	{
-		if (i == 0)
+		if (bytes == 0)
 		{
-			shortest_solution_length_so_far = solutions[i].moves.size();
-			index_of_best_solution = i;
+			return; // there's nothing to map, and mapping nothing is an error
 		}
-		else
+#ifdef _WIN32
+		file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		mapping = file == INVALID_HANDLE_VALUE ? nullptr : CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+#else
+		auto descriptor {open(path.c_str(), O_RDONLY)};
+		if (descriptor >= 0)
 		{
-			auto this_solution_length {solutions[i].moves.size()};
-			if (this_solution_length < shortest_solution_length_so_far)
+			data = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, descriptor, 0);
+			close(descriptor); // the mapping keeps the file open
+			if (data == MAP_FAILED)
 			{
-				shortest_solution_length_so_far = this_solution_length;
-				index_of_best_solution = i;
+				data = nullptr;
+			}
+			else if (read_in_order)
+			{
+				madvise(data, bytes, MADV_SEQUENTIAL); // it's read front to back once, so read ahead and don't hang on to what's been read
 			}
 		}
+#endif
+		if (!data)
+		{
+			release();
+			throw std::runtime_error("can't map " + path.string());
+		}
 	}
-	return solutions[index_of_best_solution];
-}
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+	~mapped_file()
+	{
+		release();
+	}
+	std::span<const std::uint64_t> words() const { return {static_cast<const std::uint64_t*>(data), bytes / sizeof(std::uint64_t)}; }
+	std::span<const std::uint8_t> contents() const { return {static_cast<const std::uint8_t*>(data), bytes}; }
+private:
+	size_t bytes;
+	void* data {nullptr};
+#ifdef _WIN32
+	HANDLE file {INVALID_HANDLE_VALUE};
+	HANDLE mapping {nullptr};
+#endif
+
+	void release()
+	{
+#ifdef _WIN32
+		if (data)
+		{
+			UnmapViewOfFile(data);
+		}
+		if (mapping)
+		{
+			CloseHandle(mapping);
+		}
+		if (file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(file);
+		}
+#else
+		if (data)
+		{
+			munmap(data, bytes);
+		}
+#endif
+	}
+};
 
-void report_best_solution(std::vector<solution> solutions)
+// A directory of the search's own, removed with everything in it when the search is over, however it ends.
+class scratch_directory
 {
-	auto& best_solution {solutions.front()};
+public:
+	std::filesystem::path path;
+	scratch_directory(const std::filesystem::path& parent, std::uint64_t tag) :
+		path {parent / std::format("solve-waterflow-{:016x}", mix64(tag ^ static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count())))}
+	{
+		std::filesystem::create_directories(path);
+	}
+	scratch_directory(const scratch_directory&) = delete;
+	scratch_directory& operator=(const scratch_directory&) = delete;
+	~scratch_directory()
+	{
+		std::error_code ignored;
+		std::filesystem::remove_all(path, ignored);
+	}
+};
 
-	std::cout << "found [" << solutions.size() << "] [" << best_solution.moves.size() << "] length solutions. One is: " << std::endl;
-	std::cout << best_solution;
-}
+// A board with only one or two of its colours told apart, the pattern, and every other colour as one colour.
+// Each tube is 2 bits a slot from the bottom up: 0 empty, 1 and 2 the pattern colours, 3 everything else.
+// An abstract pour can pour any part of the top run, not just as much as fits, so every real pour is also an abstract pour,
+// and the fewest abstract pours to a finished board is never more than the fewest real ones.
+class abstract_board
+{
+public:
+	using key_type = std::array<std::uint64_t, 2>;
+	static constexpr std::uint16_t other {3};
+	std::array<std::uint16_t, max_tube_count> tubes {};
+	size_t tube_count {};
+	size_t capacity {};
+
+	static bool fits(size_t tube_count, size_t capacity) { return capacity != 0 && capacity <= 8 && tube_count <= max_tube_count && tube_count * capacity * 2 <= 128; }
+	static std::uint16_t run_of(std::uint16_t symbol, size_t length) { return static_cast<std::uint16_t>(symbol * (0x5555 & ((1u << (2 * length)) - 1))); }
+	static abstract_board of(const game_state& board, colour first, colour second)
+	{
+		// a whole tube at a time: each slot's nibble is made 3 if it's filled, 1 or 2 if it's a pattern colour,
+		// then the nibbles are squeezed down to 2 bits each
+		auto slots_that_are {[](std::uint64_t contents) { return (contents | contents >> 1 | contents >> 2 | contents >> 3) & colour_in_every_slot(static_cast<colour>(1)); }};
+		abstract_board abstract {{}, board.tube_count, board.test_tubes[0].capacity};
+		for (size_t i {0}; i < board.tube_count; ++i)
+		{
+			auto contents {board.test_tubes[i].contents};
+			auto filled {slots_that_are(contents)};
+			auto firsts {filled & ~slots_that_are(contents ^ colour_in_every_slot(first))};
+			auto seconds {filled & ~slots_that_are(contents ^ colour_in_every_slot(second))};
+			auto code {static_cast<std::uint32_t>((filled * 3) ^ (firsts * 2) ^ seconds)};
+			code = (code | code >> 2) & 0x0F0F0F0F;
+			code = (code | code >> 4) & 0x00FF00FF;
+			code = (code | code >> 8) & 0x0000FFFF;
+			abstract.tubes[i] = static_cast<std::uint16_t>(code);
+		}
+		return abstract;
+	}
+	static abstract_board from_key(key_type key, size_t tube_count, size_t capacity)
+	{
+		abstract_board abstract {{}, tube_count, capacity};
+		const auto bits {2 * capacity};
+		for (size_t i {tube_count}; i-- > 0;)
+		{
+			abstract.tubes[i] = static_cast<std::uint16_t>(key[1] & ((1u << bits) - 1));
+			key[1] = (key[1] >> bits) | (key[0] << (64 - bits));
+			key[0] >>= bits;
+		}
+		return abstract;
+	}
+	key_type key(size_t pattern_colours) const
+	{
+		// the same for every order of the tubes and both namings of the pattern colours, which are all the same distance from finished
+		if (pattern_colours == 1)
+		{
+			return pack(tubes);
+		}
+		auto swapped {tubes};
+		for (auto& code : swapped)
+		{
+			code ^= static_cast<std::uint16_t>(((code ^ (code >> 1)) & 0x5555) * 3); // flips both bits of each slot whose two bits differ: 1 <-> 2
+		}
+		return (std::min)(pack(tubes), pack(swapped));
+	}
+	size_t filled(size_t i) const { return (std::bit_width(tubes[i]) + 1) / 2; }
+	template <typename function>
+	void for_each_board_one_pour_before(function&& f) const
+	{
+		// undoes every abstract pour that could have made this board
+		for (size_t to {0}; to < tube_count; ++to)
+		{
+			auto filled_to {filled(to)};
+			if (filled_to == 0)
+			{
+				continue;
+			}
+			auto symbol {static_cast<std::uint16_t>((tubes[to] >> (2 * (filled_to - 1))) & 3)};
+			size_t run {1};
+			while (run < filled_to && ((tubes[to] >> (2 * (filled_to - 1 - run))) & 3) == symbol)
+			{
+				run++;
+			}
+			// the pour landed on the same colour or in an empty tube, so it can't have been the whole run unless that's the whole tube
+			auto most {run == filled_to ? run : run - 1};
+			for (size_t amount {1}; amount <= most; ++amount)
+			{
+				for (size_t from {0}; from < tube_count; ++from)
+				{
+					auto filled_from {filled(from)};
+					if (from == to || capacity - filled_from < amount)
+					{
+						continue;
+					}
+					auto before {*this};
+					before.tubes[to] = static_cast<std::uint16_t>(tubes[to] & ((1u << (2 * (filled_to - amount))) - 1));
+					before.tubes[from] = static_cast<std::uint16_t>(tubes[from] | (run_of(symbol, amount) << (2 * filled_from)));
+					f(before);
+				}
+			}
+		}
+	}
+private:
+	key_type pack(std::array<std::uint16_t, max_tube_count> codes) const
+	{
+		std::sort(codes.begin(), codes.begin() + tube_count);
+		key_type key {};
+		const auto bits {2 * capacity};
+		for (size_t i {0}; i < tube_count; ++i)
+		{
+			key[0] = (key[0] << bits) | (key[1] >> (64 - bits));
+			key[1] = (key[1] << bits) | codes[i];
+		}
+		return key;
+	}
+};
 
-const game_state level_50 {{
-	{magenta, yellow, dark_green, orange},
-	{yellow, dark_blue, cream, dark_blue},
-	{light_blue, pink, dark_blue, light_green},
-	{light_blue, pink, magenta, cream},
-	{yellow, light_blue, magenta, dark_blue},
-	{yellow, light_green, light_green, light_green},
-	{cream, pink, dark_green, light_blue},
+// The distance to finished of every abstract board of one shape of level, worked out once by build and saved to a file.
+// The file is mapped, not read in, so the solvers on a machine share one copy of it through the page cache,
+// and a solver that only runs for a moment doesn't pay to load it. It's written in the machine's own byte order.
+class pattern_database
+{
+public:
+	class header
+	{
+	public:
+		std::uint64_t magic {file_magic};
+		std::uint32_t version {file_version};
+		std::uint32_t capacity {};
+		std::uint32_t tube_count {};
+		std::uint32_t colours {};
+		std::uint32_t pattern_colours {};
+		std::uint32_t largest_distance {};
+		std::uint64_t boards {}; // followed by each board's key, 2 words, sorted, then each board's distance, a byte
+	};
+	static constexpr std::uint64_t file_magic {0x4244502d776f6c66}; // "flow-PDB"
+	static constexpr std::uint32_t file_version {1};
+	static constexpr std::uint8_t unreachable {std::numeric_limits<std::uint8_t>::max()};
+
+	pattern_database(const std::filesystem::path& path) : file {path, false}
+	{
+		auto contents {file.contents()};
+		if (contents.size() < sizeof(header))
+		{
+			throw std::runtime_error(path.string() + " isn't a pattern database");
+		}
+		std::memcpy(&shape, contents.data(), sizeof(header));
+		if (shape.magic != file_magic)
+		{
+			throw std::runtime_error(path.string() + " isn't a pattern database");
+		}
+		if (shape.version != file_version)
+		{
+			throw std::runtime_error(std::format("{} is version {} of the pattern database format, and this is version {}", path.string(), shape.version, file_version));
+		}
+		if (contents.size() != sizeof(header) + shape.boards * (sizeof(abstract_board::key_type) + 1))
+		{
+			throw std::runtime_error(path.string() + " has been cut short");
+		}
+		keys = file.words().subspan(sizeof(header) / sizeof(std::uint64_t), shape.boards * 2);
+		distances = contents.subspan(sizeof(header) + keys.size_bytes());
+	}
+	const header& built_for() const { return shape; }
+	bool fits(const game_state& board) const
+	{
+		// only a level of the shape it was built for: its tube count, one capacity for every tube, and its number of colours
+		std::uint32_t colours_seen {0};
+		for (const auto& tube : board.tubes())
+		{
+			if (tube.capacity != shape.capacity)
+			{
+				return false;
+			}
+			for (size_t slot {0}; slot < tube.filled_slots(); ++slot)
+			{
+				colours_seen |= 1u << tube.colour_at(slot);
+			}
+		}
+		return board.tube_count == shape.tube_count && static_cast<std::uint32_t>(std::popcount(colours_seen)) == shape.colours;
+	}
+	static void check_it_fits(const pattern_database* patterns, const game_state& board)
+	{
+		if (patterns && !patterns->fits(board))
+		{
+			throw std::runtime_error(std::format("the pattern database is for levels of {} colours in {} tubes of {}", patterns->shape.colours, patterns->shape.tube_count, patterns->shape.capacity));
+		}
+	}
+	bool can_cut(const game_state& board, size_t pours_so_far, size_t most_pours) const
+	{
+		// true when the board can't be finished in most_pours. It's only looked up when the bound could be big enough,
+		// and stops at the first pattern that's far enough out.
+		return pours_so_far + shape.largest_distance > most_pours && any_pattern(board, [&](size_t distance) { return pours_so_far + distance > most_pours; });
+	}
+	size_t lower_bound(const game_state& board) const
+	{
+		size_t bound {0};
+		any_pattern(board, [&](size_t distance) {
+			bound = (std::max)(bound, distance);
+			return false;
+		});
+		return bound;
+	}
+	static void build(const std::filesystem::path& path, size_t colours, size_t capacity, size_t tube_count, size_t pattern_colours);
+private:
+	mapped_file file;
+	header shape;
+	std::span<const std::uint64_t> keys;
+	std::span<const std::uint8_t> distances;
+
+	template <typename function>
+	bool any_pattern(const game_state& board, function&& stop_at) const
+	{
+		// The level's colours are taken a pattern at a time, in order, and the largest distance of any of them is a bound.
+		// A board whose abstract board can't be finished can't be finished itself.
+		std::uint32_t colours_seen {0};
+		for (const auto& tube : board.tubes())
+		{
+			for (auto contents {tube.contents}; contents != 0; contents >>= bits_per_slot)
+			{
+				colours_seen |= 1u << (contents & slot_mask);
+			}
+		}
+		std::array<colour, colours_per_slot> colours {};
+		size_t colour_count {0};
+		for (auto seen {colours_seen}; seen != 0; seen &= seen - 1)
+		{
+			colours[colour_count++] = static_cast<colour>(std::countr_zero(seen));
+		}
+
+		for (size_t first {0}; first < colour_count; first += shape.pattern_colours)
+		{
+			auto start {(std::min)(first, colour_count - shape.pattern_colours)}; // the last pattern overlaps the one before when they don't divide evenly
+			auto second {shape.pattern_colours == 2 ? colours[start + 1] : empty}; // no filled slot is empty, so nothing matches it
+			if (stop_at(static_cast<size_t>(distance(abstract_board::of(board, colours[start], second).key(shape.pattern_colours)))))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+	std::uint8_t distance(const abstract_board::key_type& key) const
+	{
+		size_t low {0};
+		size_t high {static_cast<size_t>(shape.boards)};
+		while (low < high)
+		{
+			auto middle {low + (high - low) / 2};
+			abstract_board::key_type candidate {keys[middle * 2], keys[middle * 2 + 1]};
+			if (candidate < key)
+			{
+				low = middle + 1;
+			}
+			else
+			{
+				high = middle;
+			}
+		}
+		if (low != shape.boards && keys[low * 2] == key[0] && keys[low * 2 + 1] == key[1])
+		{
+			return distances[low];
+		}
+		return unreachable;
+	}
+};
+
+void pattern_database::build(const std::filesystem::path& path, size_t colours, size_t capacity, size_t tube_count, size_t pattern_colours)
+{
+	// breadth-first backwards from the finished board, undoing pours, so every abstract board that can be finished is reached
+	// at its distance from finished
+	if (pattern_colours < 1 || pattern_colours > 2 || colours < pattern_colours || colours > tube_count || !abstract_board::fits(tube_count, capacity))
+	{
+		throw std::runtime_error("there's no pattern database of that shape: 1 or 2 pattern colours, and each abstract board has to fit in 128 bits");
+	}
+
+	abstract_board finished {{}, tube_count, capacity};
+	for (size_t i {0}; i < colours; ++i)
+	{
+		auto symbol {i < pattern_colours ? static_cast<std::uint16_t>(i + 1) : abstract_board::other};
+		finished.tubes[i] = abstract_board::run_of(symbol, capacity);
+	}
+
+	class entry
+	{
+	public:
+		abstract_board::key_type key;
+		std::uint8_t distance;
+	};
+	std::vector<entry> seen {{finished.key(pattern_colours), 0}};
+	std::vector<abstract_board::key_type> frontier {finished.key(pattern_colours)};
+	for (std::uint8_t distance {1}; !frontier.empty(); ++distance)
+	{
+		if (distance == unreachable)
+		{
+			throw std::runtime_error("some abstract boards are too far from finished to store");
+		}
+		std::vector<abstract_board::key_type> reached;
+		for (const auto& key : frontier)
+		{
+			abstract_board::from_key(key, tube_count, capacity).for_each_board_one_pour_before([&](const abstract_board& before) { reached.push_back(before.key(pattern_colours)); });
+		}
+		std::ranges::sort(reached);
+		reached.erase(std::unique(reached.begin(), reached.end()), reached.end());
+
+		// the ones not seen already are this far from finished. Both lists are sorted, so one pass finds them and merges them in.
+		frontier.clear();
+		std::vector<entry> merged;
+		merged.reserve(seen.size() + reached.size());
+		auto old {seen.begin()};
+		for (const auto& key : reached)
+		{
+			while (old != seen.end() && old->key < key)
+			{
+				merged.push_back(*old++);
+			}
+			if (old != seen.end() && old->key == key)
+			{
+				continue;
+			}
+			merged.push_back({key, distance});
+			frontier.push_back(key);
+		}
+		merged.insert(merged.end(), old, seen.end());
+		seen = std::move(merged);
+	}
+
+	header shape;
+	shape.capacity = static_cast<std::uint32_t>(capacity);
+	shape.tube_count = static_cast<std::uint32_t>(tube_count);
+	shape.colours = static_cast<std::uint32_t>(colours);
+	shape.pattern_colours = static_cast<std::uint32_t>(pattern_colours);
+	shape.boards = seen.size();
+	shape.largest_distance = static_cast<std::uint32_t>(std::ranges::max(seen, {}, &entry::distance).distance);
+
+	std::ofstream out {path, std::ios::binary};
+	out.write(reinterpret_cast<const char*>(&shape), sizeof(shape));
+	for (const auto& board : seen)
+	{
+		out.write(reinterpret_cast<const char*>(board.key.data()), sizeof(board.key));
+	}
+	for (const auto& board : seen)
+	{
+		out.write(reinterpret_cast<const char*>(&board.distance), 1);
+	}
+	if (!out)
+	{
+		throw std::runtime_error("can't write " + path.string());
+	}
+}
+
+// What a cache has kept about a level it has seen before, in any tube order and any colour names.
+class cached_solution
+{
+public:
+	solution best; // a shortest solution, in the tube numbers of the board that was looked up
+	std::uint64_t shortest_solutions {}; // how many shortest solutions the level has, or 0 if counting them ran into a limit
+};
+
+// Levels that have been solved before, on disk, keyed by their canonical board, so a repeat of a level,
+// or a copy of it with its tubes shuffled or its colours swapped, is answered without searching it again.
+// The file is only ever appended to. Each record is written in one go, checksummed, and read in place from a mapping,
+// so any number of readers can have it open while somebody adds to it, and a record cut short by a crash is skipped.
+// Records added after a cache was opened are only seen by caches opened after that, and by the one that added them.
+class solution_cache
+{
+public:
+	class file_header
+	{
+	public:
+		std::uint64_t magic {file_magic};
+		std::uint32_t version {file_version};
+		std::uint32_t unused {};
+	};
+	class record_header
+	{
+	public:
+		std::uint32_t record_bytes {}; // all of the record, a multiple of 8
+		std::uint32_t checksum {}; // of everything after it
+		std::uint64_t key {}; // the canonical board's hash
+		std::uint64_t shortest_solutions {};
+		std::uint16_t move_count {};
+		std::uint8_t tube_count {};
+		std::uint8_t unused[5] {};
+		// followed by the canonical contents, a word per tube, the capacities, a byte per tube,
+		// and the solution in canonical tube numbers, a packed_move per pour, padded out with zeros
+	};
+	static constexpr std::uint64_t file_magic {0x4843432d776f6c66}; // "flow-CCH"
+	static constexpr std::uint32_t file_version {2}; // version 1 kept how many solutions the search came to, not how many the level has
+
+	solution_cache(const std::filesystem::path& path) : path {path}
+	{
+		if (!std::filesystem::exists(path) || std::filesystem::file_size(path) == 0)
+		{
+			file_header header {};
+			std::ofstream out {path, std::ios::binary | std::ios::app};
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			if (!out)
+			{
+				throw std::runtime_error("can't write " + path.string());
+			}
+		}
+		file.emplace(path, false);
+
+		auto contents {file->contents()};
+		file_header header {};
+		if (contents.size() < sizeof(header))
+		{
+			throw std::runtime_error(path.string() + " isn't a solution cache");
+		}
+		std::memcpy(&header, contents.data(), sizeof(header));
+		if (header.magic != file_magic)
+		{
+			throw std::runtime_error(path.string() + " isn't a solution cache");
+		}
+		if (header.version != file_version)
+		{
+			throw std::runtime_error(std::format("{} is version {} of the solution cache format, and this is version {}", path.string(), header.version, file_version));
+		}
+
+		for (size_t offset {sizeof(header)}; offset + sizeof(record_header) <= contents.size();)
+		{
+			record_header record {};
+			std::memcpy(&record, contents.data() + offset, sizeof(record));
+			if (record.record_bytes < sizeof(record) || record.record_bytes % 8 != 0 || offset + record.record_bytes > contents.size())
+			{
+				break; // the end was cut short, and there's no telling where anything after it starts
+			}
+			auto bytes {contents.subspan(offset, record.record_bytes)};
+			if (record.checksum == checksum_of(bytes) && record.record_bytes == record_bytes_for(record.tube_count, record.move_count))
+			{
+				index.emplace(record.key, bytes);
+			}
+			offset += record.record_bytes;
+		}
+	}
+	solution_cache(const solution_cache&) = delete;
+	solution_cache& operator=(const solution_cache&) = delete;
+
+	size_t size() const
+	{
+		std::lock_guard lock {mutex};
+		return index.size();
+	}
+	std::optional<cached_solution> find(const game_state& board) const
+	{
+		// The hash only picks the candidates: a record has to have exactly the same canonical board,
+		// and its solution has to solve this board, before it's believed.
+		canonical_board canonical {board.tubes()};
+		std::lock_guard lock {mutex};
+		auto [first, last] {index.equal_range(canonical.hash())};
+		for (auto entry {first}; entry != last; ++entry)
+		{
+			if (auto found {read(entry->second, canonical)}; found && board.is_solved_by(found->best))
+			{
+				return found;
+			}
+		}
+		return std::nullopt;
+	}
+	void add(const game_state& board, const solution& best, std::uint64_t shortest_solutions)
+	{
+		canonical_board canonical {board.tubes()};
+		std::array<std::uint8_t, max_tube_count> canonical_tube_index {}; // real tube -> its canonical position
+		for (size_t i {0}; i < canonical.tube_count; ++i)
+		{
+			canonical_tube_index[canonical.real_tube_index[i]] = static_cast<std::uint8_t>(i);
+		}
+
+		record_header record {};
+		record.key = canonical.hash();
+		record.shortest_solutions = shortest_solutions;
+		record.move_count = static_cast<std::uint16_t>(best.moves.size());
+		record.tube_count = static_cast<std::uint8_t>(canonical.tube_count);
+		record.record_bytes = record_bytes_for(record.tube_count, record.move_count);
+
+		std::vector<std::uint8_t> bytes(record.record_bytes);
+		auto out {bytes.data() + sizeof(record)};
+		std::memcpy(out, canonical.contents.data(), canonical.tube_count * sizeof(std::uint64_t));
+		out += canonical.tube_count * sizeof(std::uint64_t);
+		std::memcpy(out, canonical.capacities.data(), canonical.tube_count);
+		out += canonical.tube_count;
+		for (const auto& move : best.moves)
+		{
+			packed_move packed {{canonical_tube_index[move.from.tube_index], canonical_tube_index[move.to.tube_index], move.move_size}};
+			std::memcpy(out, &packed.bits, sizeof(packed.bits));
+			out += sizeof(packed.bits);
+		}
+		std::memcpy(bytes.data(), &record, sizeof(record));
+		record.checksum = checksum_of(bytes);
+		std::memcpy(bytes.data(), &record, sizeof(record));
+
+		std::lock_guard lock {mutex};
+		auto [first, last] {index.equal_range(record.key)};
+		for (auto entry {first}; entry != last; ++entry)
+		{
+			if (read(entry->second, canonical))
+			{
+				return; // already there
+			}
+		}
+		{
+			// opened for appending, so the record goes on the end whoever else has added to the file since
+			std::ofstream out {path, std::ios::binary | std::ios::app};
+			out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+			if (!out)
+			{
+				throw std::runtime_error("can't write " + path.string());
+			}
+		}
+		index.emplace(record.key, added.emplace_back(std::move(bytes)));
+	}
+private:
+	std::filesystem::path path;
+	std::optional<mapped_file> file;
+	std::unordered_multimap<std::uint64_t, std::span<const std::uint8_t>> index; // key -> a record, in the mapping or in added
+	std::deque<std::vector<std::uint8_t>> added; // the records this cache has added, which its mapping is too old to have
+	mutable std::mutex mutex;
+
+	static std::uint32_t record_bytes_for(size_t tube_count, size_t move_count)
+	{
+		auto bytes {sizeof(record_header) + tube_count * (sizeof(std::uint64_t) + 1) + move_count * sizeof(packed_move::bits)};
+		return static_cast<std::uint32_t>((bytes + 7) / 8 * 8);
+	}
+	static std::uint32_t checksum_of(std::span<const std::uint8_t> record)
+	{
+		// every word after the record's length and checksum
+		std::uint64_t checksum {record.size()};
+		for (size_t offset {8}; offset < record.size(); offset += 8)
+		{
+			std::uint64_t word {};
+			std::memcpy(&word, record.data() + offset, sizeof(word));
+			checksum = mix64(checksum ^ word);
+		}
+		return static_cast<std::uint32_t>(checksum);
+	}
+	static std::optional<cached_solution> read(std::span<const std::uint8_t> bytes, const canonical_board& canonical)
+	{
+		// the record's solution, in the real tube numbers of the board canonical came from, if the record is for that board
+		record_header record {};
+		std::memcpy(&record, bytes.data(), sizeof(record));
+		if (record.tube_count != canonical.tube_count)
+		{
+			return std::nullopt;
+		}
+		auto in {bytes.data() + sizeof(record)};
+		if (std::memcmp(in, canonical.contents.data(), canonical.tube_count * sizeof(std::uint64_t)) != 0)
+		{
+			return std::nullopt;
+		}
+		in += canonical.tube_count * sizeof(std::uint64_t);
+		if (std::memcmp(in, canonical.capacities.data(), canonical.tube_count) != 0)
+		{
+			return std::nullopt;
+		}
+		in += canonical.tube_count;
+
+		std::vector<move> moves;
+		moves.reserve(record.move_count);
+		for (size_t i {0}; i < record.move_count; ++i)
+		{
+			packed_move packed;
+			std::memcpy(&packed.bits, in, sizeof(packed.bits));
+			in += sizeof(packed.bits);
+			auto canonical_move {packed.unpack()};
+			if (canonical_move.from.tube_index >= canonical.tube_count || canonical_move.to.tube_index >= canonical.tube_count)
+			{
+				return std::nullopt;
+			}
+			moves.push_back(canonical.to_real_move(canonical_move));
+		}
+		return cached_solution {solution {moves}, record.shortest_solutions};
+	}
+};
+
+// Open addressing over a fixed block of memory, so a hard level can't grow it until the process is killed.
+// Entries live in buckets of 4 (one cache line); when a bucket is full, the entry with the longest path is replaced,
+// because a state reached early roots a bigger subtree and is worth more to remember.
+// Forgetting a state is always safe: at worst it is examined again.
+class transposition_table
+{
+public:
+	transposition_table(size_t memory_cap_in_bytes)
+	{
+		size_t entry_count {entries_per_bucket};
+		while (entry_count * 2 * sizeof(entry) <= memory_cap_in_bytes)
+		{
+			entry_count *= 2;
+		}
+		entries.resize(entry_count);
+	}
+	bool has_already_been_examined(std::uint64_t key, size_t length_of_path_to_state)
+	{
+		auto stored_length {static_cast<std::uint32_t>(length_of_path_to_state + 1)}; // 0 marks an unused entry
+		auto bucket {&entries[(key * entries_per_bucket) & (entries.size() - 1)]};
+		entry* victim {bucket};
+		for (size_t i {0}; i < entries_per_bucket; ++i)
+		{
+			auto& candidate {bucket[i]};
+			if (in_use(candidate) && candidate.key == key)
+			{
+				if (stored_length < candidate.length_of_path)
+				{
+					candidate.length_of_path = stored_length;
+					reopened++;
+					return false;
+				}
+				else
+				{
+					return true;
+				}
+			}
+			if (in_use(*victim) && (!in_use(candidate) || candidate.length_of_path > victim->length_of_path))
+			{
+				victim = &candidate;
+			}
+		}
+
+		*victim = {key, stored_length, generation};
+		return false;
+	}
+	transposition_table& clear()
+	{
+		// Forgets every state without touching the memory, so a table can be kept for the next search rather than allocated
+		// again: the entries of every earlier generation count as unused.
+		if (++generation == 0)
+		{
+			std::fill(entries.begin(), entries.end(), entry {});
+			generation = 1;
+		}
+		reopened = 0;
+		return *this;
+	}
+	size_t size_in_bytes() const { return entries.size() * sizeof(entry); }
+	static size_t bytes_for(double boards)
+	{
+		// room to keep that many boards with the buckets filling unevenly, up to what a search gets when nobody says otherwise
+		constexpr size_t largest {size_t {256} << 20};
+		auto wanted {2 * boards * sizeof(entry)};
+		return wanted < largest ? static_cast<size_t>(wanted) : largest;
+	}
+	std::uint64_t reopened {}; // states found again by a shorter path
+private:
+	struct entry
+	{
+		std::uint64_t key {};
+		std::uint32_t length_of_path {};
+		std::uint32_t generation {}; // fits in what would otherwise be padding
+	};
+	static constexpr size_t entries_per_bucket {4};
+	std::vector<entry> entries;
+	std::uint32_t generation {1};
+
+	bool in_use(const entry& entry) const { return entry.length_of_path != 0 && entry.generation == generation; }
+};
+
+// The same buckets and replacement policy as transposition_table, but shared between threads without a lock.
+// Each entry is one atomic word: the top 56 bits of the key and the path length (+1, 0 marks an unused entry) in the low byte.
+class concurrent_transposition_table
+{
+public:
+	static constexpr size_t longest_path {254}; // the most the low byte can hold
+	concurrent_transposition_table(size_t memory_cap_in_bytes)
+	{
+		size_t entry_count {entries_per_bucket};
+		while (entry_count * 2 * sizeof(std::atomic<std::uint64_t>) <= memory_cap_in_bytes)
+		{
+			entry_count *= 2;
+		}
+		entries = std::vector<std::atomic<std::uint64_t>>(entry_count);
+	}
+	bool has_already_been_examined(std::uint64_t key, size_t length_of_path_to_state)
+	{
+		const auto tag {key & ~length_mask};
+		const auto entry_for_this_path {tag | (length_of_path_to_state + 1)};
+		auto bucket {&entries[(key * entries_per_bucket) & (entries.size() - 1)]};
+		auto* victim {&bucket[0]};
+		auto victim_entry {victim->load(std::memory_order_relaxed)};
+		for (size_t i {0}; i < entries_per_bucket; ++i)
+		{
+			auto& candidate {bucket[i]};
+			auto entry {candidate.load(std::memory_order_relaxed)};
+			while ((entry & length_mask) != 0 && (entry & ~length_mask) == tag)
+			{
+				if (entry_for_this_path >= entry)
+				{
+					return true;
+				}
+				if (candidate.compare_exchange_weak(entry, entry_for_this_path, std::memory_order_relaxed))
+				{
+					return false;
+				}
+				// someone else changed it first: look again at whatever is there now
+			}
+			if ((victim_entry & length_mask) != 0 && ((entry & length_mask) == 0 || (entry & length_mask) > (victim_entry & length_mask)))
+			{
+				victim = &candidate;
+				victim_entry = entry;
+			}
+		}
+
+		// if another thread got to the victim first we simply don't remember this state, which is always safe
+		static_cast<void>(victim->compare_exchange_strong(victim_entry, entry_for_this_path, std::memory_order_relaxed));
+		return false;
+	}
+private:
+	static constexpr size_t entries_per_bucket {8};
+	static constexpr std::uint64_t length_mask {0xFF};
+	std::vector<std::atomic<std::uint64_t>> entries;
+};
+
+// What the depth-first searches do every few thousand boards: give up if they're past the deadline, and tell whoever is watching
+// how far they've got. Between checks it costs an increment and a compare, and the counting costs a test of a null pointer.
+class search_checkpoint
+{
+public:
+	search_statistics* statistics; // where the search counts, or nullptr when nobody wants the counts
+	search_checkpoint(const search_options& options, const transposition_table* examined_boards = nullptr) :
+		statistics {options.statistics ? options.statistics : options.on_progress ? &own_statistics : nullptr},
+		options {options}, examined_boards {examined_boards}, next_progress {start + options.progress_interval}
+	{
+		if (statistics)
+		{
+			*statistics = {};
+		}
+		check(); // so a search that's already out of time, or cancelled, gives up before it starts
+	}
+	void board_expanded(size_t depth)
+	{
+		if (statistics)
+		{
+			statistics->boards_expanded++;
+			statistics->peak_depth = (std::max)(statistics->peak_depth, depth);
+		}
+		if (++boards_expanded == next_check)
+		{
+			check();
+		}
+	}
+	void finish()
+	{
+		if (statistics)
+		{
+			if (examined_boards)
+			{
+				statistics->transposition_reopens = examined_boards->reopened;
+				statistics->table_bytes = examined_boards->size_in_bytes();
+			}
+			statistics->elapsed = std::chrono::steady_clock::now() - start;
+		}
+	}
+private:
+	static constexpr std::uint64_t boards_between_checks {4096};
+	search_statistics own_statistics;
+	const search_options& options;
+	const transposition_table* examined_boards;
+	std::uint64_t boards_expanded {0};
+	std::uint64_t next_check {0};
+	std::chrono::steady_clock::time_point start {std::chrono::steady_clock::now()};
+	std::chrono::steady_clock::time_point next_progress;
+
+	void schedule_next_check()
+	{
+		// checks are spread out to keep the clock off the hot path, but the board budget is exact,
+		// so the last check lands on the first board past it
+		auto boards_left {options.max_boards_expanded - boards_expanded};
+		next_check = boards_expanded + (boards_left < boards_between_checks ? boards_left + 1 : boards_between_checks);
+	}
+	void check()
+	{
+		if (options.cancellation && options.cancellation->is_cancelled())
+		{
+			throw search_interrupted("cancelled");
+		}
+		if (boards_expanded > options.max_boards_expanded)
+		{
+			throw search_interrupted("ran out of boards");
+		}
+		auto now {std::chrono::steady_clock::now()};
+		if (now > options.deadline)
+		{
+			throw search_interrupted("ran out of time");
+		}
+		if (options.on_progress && now >= next_progress)
+		{
+			finish();
+			options.on_progress(*statistics);
+			next_progress = now + options.progress_interval;
+		}
+		schedule_next_check();
+	}
+};
+
+size_t transposition_table_bytes_for(const game_state& board, const search_options& options)
+{
+	// what a search of this board gives its transposition table: what it was asked to, or a size to suit the level, and never past the memory limit
+	auto bytes {options.transposition_table_bytes != 0 ? options.transposition_table_bytes : transposition_table::bytes_for(board.board_count_bound())};
+	return (std::min)(bytes, options.memory_limit_bytes);
+}
+
+bool game_state_has_already_been_examined(transposition_table& examined_boards, const game_state& game_state, size_t length_of_path_to_state, const search_options& options = {})
+{
+	// the key only decides which boards count as the same, the search itself always walks the real board,
+	// so the moves in a solution are already real tube indices and never need mapping back.
+	return examined_boards.has_already_been_examined(game_state.dedup_key(options), length_of_path_to_state);
+}
+
+std::vector<solution> game_state::work_out_all_solutions(game_state& given_state, const search_options& options)
+{
+	// iterative depth-first search
+	// This will find and return all of the equal shortest solutions.
+
+	size_t length_of_shortest_solution_so_far {options.max_solution_length};
+
+	std::vector<solution> solutions;
+	std::vector<move> possible_solution;
+	std::optional<transposition_table> own_table;
+	auto& examined_boards {options.table ? options.table->clear() : own_table.emplace(transposition_table_bytes_for(given_state, options))};
+	// the boards on the stack come and go millions of times, so their blocks are recycled from a pool that belongs to this solve
+	// and is handed back all at once when it returns, rather than going through the global heap every time
+	std::pmr::unsynchronized_pool_resource board_pool;
+	std::stack<game_state, std::pmr::deque<game_state>> board_stack {std::pmr::deque<game_state> {&board_pool}};
+
+	if (given_state.is_solved())
+	{
+		throw std::runtime_error("this state is already solved");
+	}
+	pattern_database::check_it_fits(options.patterns, given_state);
+
+	static_cast<void>(game_state_has_already_been_examined(examined_boards, given_state, possible_solution.size(), options));
+	board_stack.push(given_state);
+	board_stack.top().restart_move_generation();
+	search_checkpoint checkpoint {options, &examined_boards};
+	auto* statistics {checkpoint.statistics};
+	bool board_on_top_is_new {true}; // so each board is only counted the first time it's looked at, not every time the search comes back to it
+
+	while (!board_stack.empty())
+	{
+		bool this_board_generated_a_solution {false};
+		bool must_examine_child_state {false};
+		auto& state_to_examine {board_stack.top()};
+
+		if (board_stack.size() > options.max_solution_length ||
+			board_stack.size() > length_of_shortest_solution_so_far || //gt, not geq because there will always be one more state in the stack than moves in the potential solution, due to the initial state
+			(options.patterns && options.patterns->can_cut(state_to_examine, board_stack.size() - 1, length_of_shortest_solution_so_far)))
+		{
+			state_to_examine.stop_generating_moves(); // and the horse you rode in on
+			// just stop handing out moves as an easy way to say that we're done with this state. Then we fall nicely into the stack-popping section below the while.
+			if (statistics && board_on_top_is_new)
+			{
+				statistics->pruned_by_bound++;
+			}
+		}
+		else if (board_on_top_is_new)
+		{
+			checkpoint.board_expanded(board_stack.size() - 1);
+		}
+		board_on_top_is_new = false;
+
+		while (auto next_move {state_to_examine.next_possible_move(options.reduce_move_orders)})
+		{
+			auto move_to_examine {*next_move}; // the generator hands them out in the same order every time, and never the same one twice
+			// possible_solution.push_back(move_to_examine); // the move stays in the possible solution until all of its children have been examined.
+			if (statistics)
+			{
+				statistics->boards_generated++;
+			}
+
+			auto new_board {state_to_examine.generate_new_board_from_move(move_to_examine)};
+			if (new_board.is_solved())
+			{
+				if (statistics)
+				{
+					statistics->solutions_found++;
+				}
+				possible_solution.push_back(move_to_examine); // add the move to get to the solution so we can copy it off
+
+				if (possible_solution.size() < length_of_shortest_solution_so_far)
+				{
+					solutions.clear(); // I don't care about the millions of slightly less efficient solutions. Just take the shortest or those equal to the shortest.
+					length_of_shortest_solution_so_far = possible_solution.size();
+				}
+
+				if (solutions.size() < options.max_solutions)
+				{
+					solutions.push_back(possible_solution);
+				}
+				possible_solution.pop_back(); // we're looking for all solutions, so take the winning move back off the list because we want to continue on our search.
+
+				// since this is a depth first search, if state_to_examine can generate any other solutions, they must be at least as long as this one or longer.
+				// we're going to examine the rest of this state's moves, for all solutions of equally short length, but we won't examine any further down the tree.
+				this_board_generated_a_solution = true;
+			}
+			else if (!new_board.has_a_possible_move(options.reduce_move_orders))
+			{
+				// this board has no possible moves, and it's not finished, it's a loser.
+				if (statistics)
+				{
+					statistics->dead_ends++;
+				}
+			}
+			else if (game_state_has_already_been_examined(examined_boards, new_board, possible_solution.size() + 1, options)) // +1 for the size the solution would be if we included this move
+			{
+				if (statistics)
+				{
+					statistics->transposition_hits++;
+				}
+
+				// this check is really to stop us cycling endlessly between the same game states.
+				// It also stops us checking a state if we've already seen a shorter path to it.
+
+				// I'm ok with keeping this check after the check for 0 moves, because we're already not going to examine this state further, 
+				// so we don't gain anything in adding it to the examined_boards collection.
+
+				// I'm ok with not adding solved states to the collection of examined states, as we don't gain anything in doing so, 
+				// since we're not examining further down the tree once we've found a solution.
+
+				// if we don't store the path length to a state with the state, when got to a state through a long path, 
+				// we'd neglect to examine that same state if we reached it through a shorter path, 
+				// denying ourselves the opportunity to consider a potentially shorter solution.
+			}
+			else
+			{
+				if (this_board_generated_a_solution)
+				{
+					continue;
+				}
+				else
+				{
+					possible_solution.push_back(move_to_examine);
+					board_stack.push(new_board);
+					board_on_top_is_new = true;
+
+					// if state_to_examine has no more moves (because we were the last examined), 
+					// we must be careful to not immediately pop the board we just pushed.
+					must_examine_child_state = true;
+
+					break; // we stop examining the moves of this board and start examining the new board
+				}
+			}
+		}
+		if (!must_examine_child_state) // the generator has run dry, or been stopped
+		{
+			board_stack.pop();
+			if (!board_stack.empty())
+			{
+				possible_solution.pop_back(); // if we've finished with a board, we've finished with the move that lead to it
+			}
+			else
+			{
+				// The initial game state wasn't generated by applying a move from a previous board, so we can't pop it off 
+			}
+		}
+	}
+	checkpoint.finish();
+	return solutions;
+}
+
+void game_state::stream_solutions_in_place(const game_state& given_state, const search_options& options, const solution_callback& on_solution)
+{
+	with_fixed_tube_count(given_state.tube_count, [&](auto fixed_tube_count) {
+		stream_solutions_in_place_for<decltype(fixed_tube_count)::value>(given_state, options, on_solution);
+	});
+}
+
+template <size_t fixed_tube_count>
+void game_state::stream_solutions_in_place_for(const game_state& given_state, const search_options& options, const solution_callback& on_solution)
+{
+	// The same search as work_out_all_solutions, visiting the same boards in the same order and finding the same solutions,
+	// but every pour is made on one board and taken back afterwards, so a board on the path costs an undo record
+	// and a 2-byte move instead of a copy of the whole game_state.
+	// Each solution is handed to on_solution as soon as it's found, and nothing is kept once it returns.
+
+	if (given_state.is_solved())
+	{
+		throw std::runtime_error("this state is already solved");
+	}
+	pattern_database::check_it_fits(options.patterns, given_state);
+
+	size_t length_of_shortest_solution_so_far {options.max_solution_length};
+	std::vector<packed_move> path(options.max_solution_length);
+	size_t path_length {0};
+	bool stopped {false};
+	std::optional<transposition_table> own_table;
+	auto& examined_boards {options.table ? options.table->clear() : own_table.emplace(transposition_table_bytes_for(given_state, options))};
+
+	auto board {given_state.fresh_copy()};
+	std::vector<undo_record> safe_undos; // a stack shared by the whole path, since each board takes its safe pours back before its parent does
+	safe_undos.reserve(options.take_safe_moves ? options.max_solution_length : 0);
+	auto take_safe_moves {[&](std::uint32_t colours) {
+		// Makes the board's safe pours of these colours, onto the path as pours of their own, and says how many.
+		// A safe pour only touches tubes of its own colour, so it never makes a pour of another colour safe.
+		// After them, the board forgets the pour that made it, because another order of the pours before it
+		// could have stopped at a different set of safe pours, so none of its pours can be skipped.
+		size_t count {0};
+		if (options.take_safe_moves)
+		{
+			for (colours &= ~1u; colours != 0 && path_length < length_of_shortest_solution_so_far; colours &= colours - 1)
+			{
+				auto safe {board.safe_move<fixed_tube_count>(static_cast<colour>(std::countr_zero(colours)))};
+				if (!safe)
+				{
+					continue;
+				}
+				safe_undos.push_back(board.make_move<fixed_tube_count>(*safe));
+				path[path_length++] = safe_undos.back().move;
+				count++;
+			}
+			if (count != 0)
+			{
+				board.previous_move.reset();
+			}
+		}
+		return count;
+	}};
+	static_cast<void>(take_safe_moves(~0u));
+	static_cast<void>(game_state_has_already_been_examined(examined_boards, board, path_length, options));
+	search_checkpoint checkpoint {options, &examined_boards};
+	auto* statistics {checkpoint.statistics};
+
+	auto search {[&](auto& self) -> void {
+		if (path_length >= length_of_shortest_solution_so_far ||
+			(options.patterns && options.patterns->can_cut(board, path_length, length_of_shortest_solution_so_far)))
+		{
+			if (statistics)
+			{
+				statistics->pruned_by_bound++;
+			}
+			return; // anything found below here would be longer than a solution we already have
+		}
+		checkpoint.board_expanded(path_length);
+		bool this_board_generated_a_solution {false};
+		while (auto next_move {board.next_possible_move<fixed_tube_count>(options.reduce_move_orders)})
+		{
+			if (statistics)
+			{
+				statistics->boards_generated++;
+			}
+			auto undo {board.make_move<fixed_tube_count>(*next_move)};
+			path[path_length++] = undo.move;
+			// the board before had no safe pours, so only a colour this pour moved or uncovered can have one now
+			auto safe_pours {take_safe_moves((1u << board.test_tubes[next_move->to.tube_index].top_colour) | (1u << board.test_tubes[next_move->from.tube_index].top_colour))};
+			if (board.is_solved<fixed_tube_count>())
+			{
+				if (statistics)
+				{
+					statistics->solutions_found++;
+				}
+				length_of_shortest_solution_so_far = path_length; // never longer than it was, because of the check at the top
+				stopped = !on_solution({path.data(), path_length});
+				this_board_generated_a_solution = true; // the rest of this board's children can still finish as quickly, but nothing below them can
+			}
+			else if (!board.has_a_possible_move<fixed_tube_count>(options.reduce_move_orders))
+			{
+				if (statistics)
+				{
+					statistics->dead_ends++;
+				}
+			}
+			else if (game_state_has_already_been_examined(examined_boards, board, path_length, options))
+			{
+				if (statistics)
+				{
+					statistics->transposition_hits++;
+				}
+			}
+			else if (!this_board_generated_a_solution)
+			{
+				self(self);
+			}
+			for (; safe_pours != 0; --safe_pours)
+			{
+				board.unmake_move(safe_undos.back());
+				safe_undos.pop_back();
+				path_length--;
+			}
+			path_length--;
+			board.unmake_move(undo);
+			if (stopped)
+			{
+				return;
+			}
+		}
+	}};
+	if (board.is_solved<fixed_tube_count>())
+	{
+		static_cast<void>(on_solution({path.data(), path_length})); // the safe pours were all it took
+	}
+	else
+	{
+		search(search);
+	}
+	checkpoint.finish();
+}
+
+std::vector<solution> game_state::work_out_all_solutions_in_place(const game_state& given_state, const search_options& options)
+{
+	std::vector<solution> solutions;
+	size_t length_of_shortest_solution_so_far {options.max_solution_length};
+	stream_solutions_in_place(given_state, options, [&](std::span<const packed_move> moves) {
+		if (moves.size() < length_of_shortest_solution_so_far)
+		{
+			solutions.clear();
+			length_of_shortest_solution_so_far = moves.size();
+		}
+		if (solutions.size() < options.max_solutions)
+		{
+			solutions.push_back(moves);
+		}
+		return true;
+	});
+	return solutions;
+}
+
+std::optional<solution> game_state::work_out_first_solution_in_place(const game_state& given_state, const search_options& options)
+{
+	// the first one the search comes to, which is usually quick to find but not always the shortest
+	std::optional<solution> first;
+	stream_solutions_in_place(given_state, options, [&](std::span<const packed_move> moves) {
+		first.emplace(moves);
+		return false;
+	});
+	return first;
+}
+
+solution_count game_state::count_solutions_found_in_place(const game_state& given_state, const search_options& options)
+{
+	// counts the shortest solutions the search comes to, without keeping any of them
+	solution_count count {};
+	stream_solutions_in_place(given_state, options, [&](std::span<const packed_move> moves) {
+		if (count.found == 0 || moves.size() < count.length)
+		{
+			count = {moves.size(), 0};
+		}
+		count.found++;
+		return true;
+	});
+	return count;
+}
+
+anytime_solution game_state::work_out_best_solution_anytime(const game_state& given_state, const search_options& options)
+{
+	// Each solution the in-place search finds is shorter than the last, so whatever it has when a limit stops it
+	// is the best it's going to get for the time. Only a search that ran to the end has proven there's nothing shorter.
+	anytime_solution result {};
+	if (options.cache)
+	{
+		if (auto cached {options.cache->find(given_state)})
+		{
+			result.best.emplace(std::move(cached->best));
+			result.proven_shortest = true;
+			result.shortest_solutions = cached->shortest_solutions;
+			result.from_cache = true;
+			return result;
+		}
+	}
+	try
+	{
+		stream_solutions_in_place(given_state, options, [&](std::span<const packed_move> moves) {
+			if (!result.best || moves.size() < result.best->moves.size())
+			{
+				result.best.emplace(moves);
+				result.solutions_found = 0;
+			}
+			result.solutions_found++;
+			return true;
+		});
+		result.proven_shortest = result.best.has_value();
+	}
+	catch (const search_interrupted& e)
+	{
+		result.stopped_because = e.what();
+	}
+	if (options.cache && result.proven_shortest)
+	{
+		result.shortest_solutions = count_shortest_solutions(given_state, options, result.best->moves.size());
+		options.cache->add(given_state, *result.best, result.shortest_solutions);
+	}
+	return result;
+}
+
+// The states a breadth-first search has reached, with every edge that reaches a state from the layer just before it.
+// Only those edges can lie on a shortest path, so walking them back from the finished boards gives exactly the shortest solutions.
+class parent_dag
+{
+public:
+	static constexpr std::uint32_t no_edge {~std::uint32_t {0}};
+	class parent_edge
+	{
+	public:
+		std::uint32_t parent {};
+		std::uint32_t next {no_edge}; // the next edge into the same state
+		move move_to_child;
+	};
+
+	size_t tube_count {};
+	std::vector<std::uint64_t> contents; // the first board found for each state, tube_count words each
+	std::vector<std::uint32_t> layers;
+	std::vector<std::uint32_t> first_parent_edges;
+	std::vector<parent_edge> edges;
+	std::vector<std::uint32_t> goals;
+	std::unordered_map<std::uint64_t, std::uint32_t> state_of_key;
+	std::vector<std::uint64_t> path_counts; // how many shortest paths reach each state, filled in by count_paths
+
+	parent_dag(size_t tube_count) : tube_count {tube_count}
+	{}
+	std::span<const std::uint64_t> contents_of(std::uint32_t state) const { return {contents.data() + state * tube_count, tube_count}; }
+	std::pair<std::uint32_t, bool> find_or_add(std::uint64_t key, const game_state& board, std::uint32_t layer)
+	{
+		auto [found, is_new] {state_of_key.try_emplace(key, static_cast<std::uint32_t>(layers.size()))};
+		if (is_new)
+		{
+			for (const auto& tube : board.tubes())
+			{
+				contents.push_back(tube.contents);
+			}
+			layers.push_back(layer);
+			first_parent_edges.push_back(no_edge);
+		}
+		return {found->second, is_new};
+	}
+	void add_edge(std::uint32_t parent, std::uint32_t child, const move& move)
+	{
+		edges.push_back({parent, first_parent_edges[child], move});
+		first_parent_edges[child] = static_cast<std::uint32_t>(edges.size() - 1);
+	}
+	void count_paths()
+	{
+		// States are numbered in the order they were found, so every parent comes before its children
+		// and one pass adds up the paths into each state from the paths into its parents.
+		// Counts that don't fit stick at the largest number there is.
+		path_counts.assign(layers.size(), 0);
+		path_counts[0] = 1;
+		for (std::uint32_t state {1}; state < layers.size(); ++state)
+		{
+			for (auto edge {first_parent_edges[state]}; edge != no_edge; edge = edges[edge].next)
+			{
+				path_counts[state] = saturating_add(path_counts[state], path_counts[edges[edge].parent]);
+			}
+		}
+	}
+	std::uint64_t paths_to_goals() const
+	{
+		std::uint64_t paths {0};
+		for (auto goal : goals)
+		{
+			paths = saturating_add(paths, path_counts[goal]);
+		}
+		return paths;
+	}
+	size_t size_in_bytes() const
+	{
+		// near enough: the hash map's nodes are guessed at a key, a value and two pointers each
+		return contents.capacity() * sizeof(std::uint64_t) + (layers.capacity() + first_parent_edges.capacity()) * sizeof(std::uint32_t)
+			+ edges.capacity() * sizeof(parent_edge) + state_of_key.size() * 4 * sizeof(std::uint64_t) + state_of_key.bucket_count() * sizeof(void*);
+	}
+	static std::uint64_t saturating_add(std::uint64_t a, std::uint64_t b)
+	{
+		return a > std::numeric_limits<std::uint64_t>::max() - b ? std::numeric_limits<std::uint64_t>::max() : a + b;
+	}
+};
+
+// The shortest solutions of a level, kept as the breadth-first search's parent edges rather than written out.
+// Counting them costs one pass over the states, and any one of them can be rebuilt by its index,
+// in the same order work_out_shortest_solutions_breadth_first would have listed them.
+class shortest_solution_dag
+{
+public:
+	shortest_solution_dag(parent_dag dag, const game_state& given_state, const search_options& options) :
+		dag {std::move(dag)}, given_state {given_state}, options {options}
+	{
+		this->dag.count_paths();
+	}
+	size_t length() const { return dag.goals.empty() ? 0 : dag.layers[dag.goals.front()]; }
+	std::uint64_t count() const { return dag.paths_to_goals(); } // the largest std::uint64_t if there are at least that many
+	size_t states() const { return dag.layers.size(); }
+	solution solution_at(std::uint64_t index) const { return game_state::rebuild_solution(dag, given_state, options, index); }
+private:
+	parent_dag dag;
+	game_state given_state;
+	search_options options;
+};
+
+std::vector<solution> game_state::work_out_shortest_solutions_breadth_first(const game_state& given_state, const search_options& options)
+{
+	return rebuild_solutions(work_out_parent_dag(given_state, options), given_state, options);
+}
+
+shortest_solution_dag game_state::work_out_shortest_solution_dag(const game_state& given_state, const search_options& options)
+{
+	return {work_out_parent_dag(given_state, options), given_state, options};
+}
+
+std::uint64_t game_state::count_shortest_solutions(const game_state& given_state, const search_options& options, size_t length)
+{
+	// How many solutions of the length a search has already proven the level has, off the parent edges of a breadth-first search
+	// that stops there. Tubes and colours are told apart, so it counts every pour sequence, and it's the same for any copy of the level
+	// however its tubes are ordered and its colours named. It has the same limits as the search. 0 when it runs into one of them.
+	auto counting {options};
+	counting.canonicalize_tubes = false;
+	counting.canonicalize_colours = false;
+	counting.max_solution_length = length;
+	counting.statistics = nullptr; // they're the search's
+	counting.on_progress = nullptr;
+	try
+	{
+		return work_out_shortest_solution_dag(given_state, counting).count();
+	}
+	catch (const search_interrupted&)
+	{
+		return 0;
+	}
+}
+
+parent_dag game_state::work_out_parent_dag(const game_state& given_state, const search_options& options)
+{
+	// level-synchronous breadth-first search
+	// Every state in layer n is exactly n pours from the start, so the first layer with a finished board proves the shortest solution length
+	// without looking any deeper. That layer's boards are never expanded.
+
+	if (given_state.is_solved())
+	{
+		throw std::runtime_error("this state is already solved");
+	}
+
+	parent_dag dag {given_state.tube_count};
+	static_cast<void>(dag.find_or_add(given_state.dedup_key(options), given_state, 0));
+	std::vector<std::uint32_t> frontier {0};
+	search_checkpoint checkpoint {options};
+
+	for (std::uint32_t layer {0}; !frontier.empty() && dag.goals.empty() && layer < options.max_solution_length; ++layer)
+	{
+		std::vector<std::uint32_t> next_frontier;
+		for (auto state : frontier)
+		{
+			checkpoint.board_expanded(layer);
+			if (dag.size_in_bytes() > options.memory_limit_bytes)
+			{
+				throw search_interrupted("ran out of memory");
+			}
+			auto board {given_state.with_contents(dag.contents_of(state))};
+			while (auto next_move {board.next_possible_move()})
+			{
+				const auto& move {*next_move};
+				auto child {board.generate_new_board_from_move(move)};
+				auto [child_state, is_new] {dag.find_or_add(child.dedup_key(options), child, layer + 1)};
+				if (dag.layers[child_state] != layer + 1)
+				{
+					continue; // there's a shorter way to it, so this edge isn't on any shortest path
+				}
+
+				dag.add_edge(state, child_state, move);
+				if (is_new)
+				{
+					if (child.is_solved())
+					{
+						dag.goals.push_back(child_state);
+					}
+					else
+					{
+						next_frontier.push_back(child_state);
+					}
+				}
+			}
+		}
+		frontier = std::move(next_frontier);
+	}
+	checkpoint.finish();
+
+	return dag;
+}
+
+std::vector<solution> game_state::work_out_shortest_solutions_breadth_first_in_parallel(const game_state& given_state, const search_options& options)
+{
+	return rebuild_solutions(work_out_parent_dag_in_parallel(given_state, options), given_state, options);
+}
+
+shortest_solution_dag game_state::work_out_shortest_solution_dag_in_parallel(const game_state& given_state, const search_options& options)
+{
+	return {work_out_parent_dag_in_parallel(given_state, options), given_state, options};
+}
+
+parent_dag game_state::work_out_parent_dag_in_parallel(const game_state& given_state, const search_options& options)
+{
+	// the same layers as work_out_parent_dag, with each layer's boards expanded across all the threads.
+	// Every state belongs to one partition, picked by its key, and only that partition's thread ever looks it up or adds to it,
+	// so nothing needs locking: the threads expanding a layer hand each child over to the partition that owns it,
+	// and once the whole layer has been expanded each partition takes in what it was handed, in the order of the threads that handed it over.
+	// The new states are then numbered partition by partition, which still puts every state after all of its parents.
+
+	if (given_state.is_solved())
+	{
+		throw std::runtime_error("this state is already solved");
+	}
+
+	const size_t thread_count {options.threads != 0 ? options.threads : (std::max)(size_t {1}, static_cast<size_t>(std::thread::hardware_concurrency()))};
+	auto in_parallel {[&](const auto& work) {
+		std::vector<std::thread> threads;
+		for (size_t t {0}; t < thread_count; ++t)
+		{
+			threads.emplace_back(work, t);
+		}
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+	}};
+
+	class handed_over_child
+	{
+	public:
+		std::uint64_t key {};
+		std::uint32_t parent {};
+		packed_move move;
+	};
+	constexpr std::uint32_t found_in_this_layer {std::uint32_t {1} << 31}; // marks a place in new_keys rather than a state
+	class partition
+	{
+	public:
+		std::unordered_map<std::uint64_t, std::uint32_t> state_of_key;
+		std::vector<std::uint64_t> new_keys;
+		std::vector<std::uint64_t> new_contents;
+		std::vector<std::uint32_t> new_first_parent_edges;
+		std::vector<std::uint8_t> new_solved;
+		std::vector<parent_dag::parent_edge> edges; // the edges into this partition's states, numbered within the partition
+		std::vector<std::uint32_t> next_frontier;
+		std::vector<std::uint32_t> goals;
+		size_t first_new_state {};
+	};
+	std::vector<partition> partitions(thread_count);
+	std::vector<std::vector<std::vector<handed_over_child>>> handed_over(thread_count, std::vector<std::vector<handed_over_child>>(thread_count)); // by thread, then partition
+	auto owner {[&](std::uint64_t key) { return static_cast<size_t>(mix64(key) % thread_count); }};
+
+	parent_dag dag {given_state.tube_count};
+	auto start_key {given_state.dedup_key(options)};
+	static_cast<void>(dag.find_or_add(start_key, given_state, 0));
+	partitions[owner(start_key)].state_of_key.swap(dag.state_of_key); // the partitions keep all the keys between them
+	std::vector<std::uint32_t> partition_of_state {static_cast<std::uint32_t>(owner(start_key))}; // the partition holding the edges into each state
+	std::vector<std::uint32_t> frontier {0};
+	search_checkpoint checkpoint {options};
+	auto size_in_bytes {[&] {
+		auto bytes {dag.size_in_bytes() + partition_of_state.capacity() * sizeof(std::uint32_t)};
+		for (const auto& partition : partitions)
+		{
+			bytes += partition.edges.capacity() * sizeof(parent_dag::parent_edge) + partition.state_of_key.size() * 4 * sizeof(std::uint64_t)
+				+ partition.state_of_key.bucket_count() * sizeof(void*);
+		}
+		for (const auto& boxes : handed_over)
+		{
+			for (const auto& box : boxes)
+			{
+				bytes += box.capacity() * sizeof(handed_over_child);
+			}
+		}
+		return bytes;
+	}};
+
+	// The board budget is counted before each layer is shared out, so it's exact. The clock and cancellation are looked at
+	// by the workers every so many boards.
+	constexpr size_t boards_between_checks {4096};
+	std::atomic<const char*> interrupted_because {nullptr};
+
+	for (std::uint32_t layer {0}; !frontier.empty() && dag.goals.empty() && layer < options.max_solution_length; ++layer)
+	{
+		for (size_t i {0}; i < frontier.size(); ++i)
+		{
+			checkpoint.board_expanded(layer);
+		}
+		if (size_in_bytes() > options.memory_limit_bytes)
+		{
+			throw search_interrupted("ran out of memory");
+		}
+
+		in_parallel([&](size_t t) {
+			auto& boxes {handed_over[t]};
+			for (auto& box : boxes)
+			{
+				box.clear();
+			}
+			const size_t first {frontier.size() * t / thread_count}, last {frontier.size() * (t + 1) / thread_count};
+			for (auto i {first}; i < last; ++i)
+			{
+				if ((i - first) % boards_between_checks == boards_between_checks - 1)
+				{
+					const char* reason {nullptr};
+					if (options.cancellation && options.cancellation->is_cancelled())
+					{
+						reason = "cancelled";
+					}
+					else if (std::chrono::steady_clock::now() > options.deadline)
+					{
+						reason = "ran out of time";
+					}
+					if (reason)
+					{
+						const char* none {nullptr};
+						interrupted_because.compare_exchange_strong(none, reason);
+					}
+				}
+				if (interrupted_because.load(std::memory_order_relaxed))
+				{
+					return;
+				}
+				auto board {given_state.with_contents(dag.contents_of(frontier[i]))};
+				while (auto next_move {board.next_possible_move()})
+				{
+					auto key {board.generate_new_board_from_move(*next_move).dedup_key(options)};
+					boxes[owner(key)].push_back({key, frontier[i], *next_move});
+				}
+			}
+		});
+		if (auto reason {interrupted_because.load()})
+		{
+			throw search_interrupted(reason);
+		}
+
+		// Each partition takes in the children it owns. Only a child that's new to this layer is made again, from its parent and the pour,
+		// to keep its contents; a child found in an earlier layer has a shorter way to it, so its edge is dropped.
+		in_parallel([&](size_t p) {
+			auto& mine {partitions[p]};
+			mine.new_keys.clear();
+			mine.new_contents.clear();
+			mine.new_first_parent_edges.clear();
+			mine.new_solved.clear();
+			for (const auto& boxes : handed_over)
+			{
+				for (const auto& child : boxes[p])
+				{
+					auto [found, is_new] {mine.state_of_key.try_emplace(child.key, found_in_this_layer | static_cast<std::uint32_t>(mine.new_keys.size()))};
+					if ((found->second & found_in_this_layer) == 0)
+					{
+						continue;
+					}
+					auto move {child.move.unpack()};
+					if (is_new)
+					{
+						auto board {given_state.with_contents(dag.contents_of(child.parent)).generate_new_board_from_move(move)};
+						for (const auto& tube : board.tubes())
+						{
+							mine.new_contents.push_back(tube.contents);
+						}
+						mine.new_keys.push_back(child.key);
+						mine.new_first_parent_edges.push_back(parent_dag::no_edge);
+						mine.new_solved.push_back(board.is_solved());
+					}
+					auto& first_parent_edge {mine.new_first_parent_edges[found->second & ~found_in_this_layer]};
+					mine.edges.push_back({child.parent, first_parent_edge, move});
+					first_parent_edge = static_cast<std::uint32_t>(mine.edges.size() - 1);
+				}
+			}
+		});
+
+		auto states {dag.layers.size()};
+		for (auto& partition : partitions)
+		{
+			partition.first_new_state = states;
+			states += partition.new_keys.size();
+		}
+		if (states >= found_in_this_layer)
+		{
+			throw search_interrupted("ran out of memory");
+		}
+		dag.layers.resize(states, layer + 1);
+		dag.first_parent_edges.resize(states);
+		dag.contents.resize(states * dag.tube_count);
+		partition_of_state.resize(states);
+
+		in_parallel([&](size_t p) {
+			auto& mine {partitions[p]};
+			mine.next_frontier.clear();
+			mine.goals.clear();
+			for (size_t i {0}; i < mine.new_keys.size(); ++i)
+			{
+				auto state {static_cast<std::uint32_t>(mine.first_new_state + i)};
+				mine.state_of_key[mine.new_keys[i]] = state;
+				dag.first_parent_edges[state] = mine.new_first_parent_edges[i];
+				partition_of_state[state] = static_cast<std::uint32_t>(p);
+				std::copy_n(mine.new_contents.begin() + i * dag.tube_count, dag.tube_count, dag.contents.begin() + state * dag.tube_count);
+				(mine.new_solved[i] ? mine.goals : mine.next_frontier).push_back(state);
+			}
+		});
+
+		frontier.clear();
+		for (const auto& partition : partitions)
+		{
+			frontier.insert(frontier.end(), partition.next_frontier.begin(), partition.next_frontier.end());
+			dag.goals.insert(dag.goals.end(), partition.goals.begin(), partition.goals.end());
+		}
+	}
+	checkpoint.finish();
+
+	// Put the partitions' edges one after another and renumber them to match.
+	std::vector<std::uint32_t> first_edge_of_partition;
+	for (auto& partition : partitions)
+	{
+		auto first_edge {static_cast<std::uint32_t>(dag.edges.size())};
+		first_edge_of_partition.push_back(first_edge);
+		for (auto edge : partition.edges)
+		{
+			if (edge.next != parent_dag::no_edge)
+			{
+				edge.next += first_edge;
+			}
+			dag.edges.push_back(edge);
+		}
+		partition.edges = {};
+	}
+	for (std::uint32_t state {1}; state < dag.layers.size(); ++state)
+	{
+		dag.first_parent_edges[state] += first_edge_of_partition[partition_of_state[state]];
+	}
+
+	return dag;
+}
+
+std::vector<solution> game_state::rebuild_solutions(const parent_dag& dag, const game_state& given_state, const search_options& options)
+{
+	// Walk every chain of parent edges from each goal back to the start, then replay it forwards.
+	// A level can have far more shortest solutions than states, so the list counts against the memory limit too.
+	std::vector<solution> solutions;
+	std::vector<std::uint32_t> reversed_path;
+	auto bytes {dag.size_in_bytes()};
+
+	auto walk_back {[&](auto& self, std::uint32_t state) -> void {
+		if (solutions.size() == options.max_solutions)
+		{
+			return;
+		}
+		if (state == 0)
+		{
+			bytes += sizeof(solution) + reversed_path.size() * sizeof(move);
+			if (bytes > options.memory_limit_bytes)
+			{
+				throw search_interrupted("ran out of memory");
+			}
+			solutions.push_back(replay(dag, given_state, options, reversed_path));
+			return;
+		}
+		for (auto edge {dag.first_parent_edges[state]}; edge != parent_dag::no_edge; edge = dag.edges[edge].next)
+		{
+			reversed_path.push_back(edge);
+			self(self, dag.edges[edge].parent);
+			reversed_path.pop_back();
+		}
+	}};
+
+	for (auto goal : dag.goals)
+	{
+		walk_back(walk_back, goal);
+	}
+	return solutions;
+}
+
+solution game_state::rebuild_solution(const parent_dag& dag, const game_state& given_state, const search_options& options, std::uint64_t index)
+{
+	// Goes back from the goals the same way rebuild_solutions does, but skips whole edges at a time:
+	// the paths through an edge are all the paths into its parent, so the count says whether the one we want is among them.
+	std::vector<std::uint32_t> reversed_path;
+	auto state {parent_dag::no_edge};
+	for (auto goal : dag.goals)
+	{
+		if (index < dag.path_counts[goal])
+		{
+			state = goal;
+			break;
+		}
+		index -= dag.path_counts[goal];
+	}
+	if (state == parent_dag::no_edge)
+	{
+		throw std::runtime_error("there aren't that many solutions");
+	}
+	while (state != 0)
+	{
+		for (auto edge {dag.first_parent_edges[state]}; edge != parent_dag::no_edge; edge = dag.edges[edge].next)
+		{
+			auto paths_through_edge {dag.path_counts[dag.edges[edge].parent]};
+			if (index < paths_through_edge)
+			{
+				reversed_path.push_back(edge);
+				state = dag.edges[edge].parent;
+				break;
+			}
+			index -= paths_through_edge;
+		}
+	}
+	return replay(dag, given_state, options, reversed_path);
+}
+
+solution game_state::replay(const parent_dag& dag, const game_state& given_state, const search_options& options, std::span<const std::uint32_t> reversed_edges)
+{
+	// The moves on an edge are in terms of the board stored for its parent, which may be the real board with its tubes
+	// (or colours) shuffled, so real_tube_of follows which real tube each of the stored board's tubes is.
+	// The board the last pour made and the board stored for the state it reached share a dedup key, so their tubes can be matched up.
+	const bool boards_can_differ {options.canonicalize_tubes || options.canonicalize_colours};
+	std::array<std::uint8_t, max_tube_count> real_tube_of {};
+	for (size_t i {0}; i < given_state.tube_count; ++i)
+	{
+		real_tube_of[i] = static_cast<std::uint8_t>(i); // the start is stored as the real board itself
+	}
+
+	std::vector<move> moves;
+	std::optional<game_state> poured;
+	for (auto edge {reversed_edges.rbegin()}; edge != reversed_edges.rend(); ++edge)
+	{
+		const auto& parent_edge {dag.edges[*edge]};
+		auto parent {given_state.with_contents(dag.contents_of(parent_edge.parent))};
+		if (boards_can_differ && poured)
+		{
+			auto tube_in_poured {match_tubes(parent, *poured)};
+			std::array<std::uint8_t, max_tube_count> real_tube_of_parent {};
+			for (size_t i {0}; i < given_state.tube_count; ++i)
+			{
+				real_tube_of_parent[i] = real_tube_of[tube_in_poured[i]];
+			}
+			real_tube_of = real_tube_of_parent;
+		}
+
+		const auto& move {parent_edge.move_to_child};
+		moves.push_back({real_tube_of[move.from.tube_index], real_tube_of[move.to.tube_index], move.move_size});
+		poured = parent.generate_new_board_from_move(move);
+	}
+	return moves;
+}
+
+// Merges sorted runs of new states against the sorted file of every state seen so far. States that are in a run but not in
+// the seen file make the next layer, and the seen file is rewritten with them in it. Every file is read front to back once.
+void merge_into_next_layer(const std::vector<std::filesystem::path>& runs, const std::filesystem::path& seen, size_t record_words,
+	const std::filesystem::path& next_layer, const std::filesystem::path& next_seen)
+{
+	using record = std::span<const std::uint64_t>;
+	auto less {[](record a, record b) { return std::ranges::lexicographical_compare(a, b); }};
+
+	std::vector<std::unique_ptr<mapped_file>> run_files;
+	std::vector<size_t> run_positions(runs.size(), 0);
+	auto run_record {[&](size_t run) { return run_files[run]->words().subspan(run_positions[run], record_words); }};
+	auto run_is_finished {[&](size_t run) { return run_positions[run] == run_files[run]->words().size(); }};
+	auto later {[&](size_t a, size_t b) { return less(run_record(b), run_record(a)); }}; // so the heap's top is the smallest
+	std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heads {later};
+	for (size_t run {0}; run < runs.size(); ++run)
+	{
+		run_files.push_back(std::make_unique<mapped_file>(runs[run]));
+		if (!run_is_finished(run))
+		{
+			heads.push(run);
+		}
+	}
+
+	mapped_file seen_file {seen};
+	auto seen_words {seen_file.words()};
+	size_t seen_position {0};
+
+	std::ofstream layer_out {next_layer, std::ios::binary};
+	std::ofstream seen_out {next_seen, std::ios::binary};
+	auto write {[&](std::ofstream& out, record r) { out.write(reinterpret_cast<const char*>(r.data()), static_cast<std::streamsize>(r.size_bytes())); }};
+
+	std::vector<std::uint64_t> last_new_state;
+	while (!heads.empty())
+	{
+		auto run {heads.top()};
+		heads.pop();
+		auto state {run_record(run)};
+
+		// the same state can be in more than one run, and the runs are merged in order, so a repeat always follows straight after
+		if (last_new_state.empty() || !std::ranges::equal(state, last_new_state))
+		{
+			last_new_state.assign(state.begin(), state.end());
+			while (seen_position != seen_words.size() && less(seen_words.subspan(seen_position, record_words), state))
+			{
+				write(seen_out, seen_words.subspan(seen_position, record_words));
+				seen_position += record_words;
+			}
+			if (seen_position == seen_words.size() || !std::ranges::equal(seen_words.subspan(seen_position, record_words), state))
+			{
+				write(layer_out, state);
+				write(seen_out, state);
+			}
+		}
+
+		run_positions[run] += record_words;
+		if (!run_is_finished(run))
+		{
+			heads.push(run);
+		}
+	}
+	for (; seen_position != seen_words.size(); seen_position += record_words)
+	{
+		write(seen_out, seen_words.subspan(seen_position, record_words));
+	}
+	if (!layer_out || !seen_out)
+	{
+		throw std::runtime_error("can't write " + next_layer.parent_path().string());
+	}
+}
+
+std::optional<size_t> game_state::work_out_shortest_length_externally(const game_state& given_state, const std::filesystem::path& work_directory, const search_options& options)
+{
+	// breadth-first search with the layers on disk
+	// Each layer is a file of sorted, packed boards. Expanding it fills a buffer with children, and every time the buffer is full
+	// it's sorted and written out as a run. Duplicates are only found once the layer is done, by merging the runs against a sorted
+	// file of every board seen so far. Memory stays at the buffer no matter how many boards there are: the files are mapped,
+	// not read in. It only proves the length: nothing is kept to work out which pours get there.
+	// Returns nothing when there's no solution within max_solution_length.
+
+	if (given_state.is_solved())
+	{
+		throw std::runtime_error("this state is already solved");
+	}
+
+	// A board is stored as its tubes' contents. With canonicalize_tubes they're sorted by capacity then contents, so the
+	// capacities always come out in the same order and every board can be rebuilt from the layout's tubes.
+	const auto record_words {given_state.tube_count};
+	std::vector<size_t> layout_order(record_words);
+	std::iota(layout_order.begin(), layout_order.end(), size_t {0});
+	auto by_capacity_then_contents {[](const test_tube& a, const test_tube& b) { return std::tie(a.capacity, a.contents) < std::tie(b.capacity, b.contents); }};
+	if (options.canonicalize_tubes)
+	{
+		std::ranges::sort(layout_order, [&](size_t a, size_t b) { return by_capacity_then_contents(given_state.test_tubes[a], given_state.test_tubes[b]); });
+	}
+	std::vector<std::vector<colour>> layout_tubes;
+	for (auto i : layout_order)
+	{
+		const auto& tube {given_state.test_tubes[i]};
+		auto& colours {layout_tubes.emplace_back()};
+		for (size_t slot {0}; slot < tube.capacity; ++slot)
+		{
+			colours.push_back(tube.colour_at(slot));
+		}
+	}
+	const game_state layout {layout_tubes};
+
+	auto pack {[&](const game_state& board, std::vector<std::uint64_t>& out) {
+		std::array<test_tube, max_tube_count> tubes {board.test_tubes};
+		if (options.canonicalize_tubes)
+		{
+			std::sort(tubes.begin(), tubes.begin() + record_words, by_capacity_then_contents);
+		}
+		for (size_t i {0}; i < record_words; ++i)
+		{
+			out.push_back(tubes[i].contents);
+		}
+	}};
+
+	const size_t memory_cap {transposition_table_bytes_for(given_state, options)};
+	const size_t records_per_run {(std::max)(size_t {1}, memory_cap / (record_words * sizeof(std::uint64_t) + sizeof(std::uint32_t)))};
+
+	scratch_directory scratch {work_directory, given_state.hash};
+	auto file {[&](std::string_view kind, size_t number) { return scratch.path / std::format("{}-{}", kind, number); }};
+	{
+		std::vector<std::uint64_t> start;
+		pack(layout, start);
+		for (auto name : {file("layer", 0), file("seen", 0)})
+		{
+			std::ofstream out {name, std::ios::binary};
+			out.write(reinterpret_cast<const char*>(start.data()), static_cast<std::streamsize>(start.size() * sizeof(std::uint64_t)));
+		}
+	}
+
+	search_checkpoint checkpoint {options};
+	std::vector<std::uint64_t> buffer;
+	std::vector<std::filesystem::path> runs;
+
+	auto write_run {[&] {
+		// sorted through an index, because the records' width is only known at run time
+		std::vector<std::uint32_t> order(buffer.size() / record_words);
+		std::iota(order.begin(), order.end(), std::uint32_t {0});
+		auto record {[&](std::uint32_t i) { return std::span<const std::uint64_t> {buffer.data() + i * record_words, record_words}; }};
+		std::ranges::sort(order, [&](auto a, auto b) { return std::ranges::lexicographical_compare(record(a), record(b)); });
+
+		runs.push_back(file("run", runs.size()));
+		std::ofstream out {runs.back(), std::ios::binary};
+		for (size_t i {0}; i < order.size(); ++i)
+		{
+			if (i == 0 || !std::ranges::equal(record(order[i]), record(order[i - 1])))
+			{
+				out.write(reinterpret_cast<const char*>(record(order[i]).data()), static_cast<std::streamsize>(record_words * sizeof(std::uint64_t)));
+			}
+		}
+		if (!out)
+		{
+			throw std::runtime_error("can't write " + runs.back().string());
+		}
+		buffer.clear();
+	}};
+
+	for (size_t layer {0}; layer < options.max_solution_length; ++layer)
+	{
+		{
+			mapped_file frontier {file("layer", layer)};
+			auto words {frontier.words()};
+			if (words.empty())
+			{
+				break; // nothing new was reached, so everything reachable has been, and none of it is solved
+			}
+			for (size_t position {0}; position < words.size(); position += record_words)
+			{
+				checkpoint.board_expanded(layer);
+				auto board {layout.with_contents(words.subspan(position, record_words))};
+				while (auto next_move {board.next_possible_move()})
+				{
+					auto child {board.generate_new_board_from_move(*next_move)};
+					if (child.is_solved())
+					{
+						checkpoint.finish();
+						return layer + 1;
+					}
+					pack(child, buffer);
+					if (buffer.size() == records_per_run * record_words)
+					{
+						write_run();
+					}
+				}
+			}
+		}
+		write_run();
+		merge_into_next_layer(runs, file("seen", layer), record_words, file("layer", layer + 1), file("seen", layer + 1));
+		for (const auto& run : runs)
+		{
+			std::filesystem::remove(run);
+		}
+		runs.clear();
+		std::filesystem::remove(file("layer", layer));
+		std::filesystem::remove(file("seen", layer));
+	}
+	checkpoint.finish();
+	return std::nullopt;
+}
+
+std::vector<solution> game_state::work_out_shortest_solutions_iterative_deepening(const game_state& given_state, const search_options& options)
+{
+	// iterative deepening A*
+	// Each iteration is a depth-first search that gives up on a board once the pours so far plus lower_bound_on_moves_left
+	// go over the bound, and the next bound is the smallest total that went over. The bound never overshoots because the
+	// lower bound never does, so the first iteration that finishes a board has found the shortest length.
+	// Nothing is remembered between boards except the current path, so memory only grows with the solution length.
+
+	if (given_state.is_solved())
+	{
+		throw std::runtime_error("this state is already solved");
+	}
+
+	std::vector<solution> solutions;
+	std::vector<move> possible_solution;
+	std::vector<std::uint64_t> hashes_on_path {given_state.hash};
+	size_t bound {given_state.lower_bound_on_moves_left()};
+	constexpr size_t no_bound {std::numeric_limits<size_t>::max()};
+	search_checkpoint checkpoint {options};
+
+	while (solutions.empty() && bound <= options.max_solution_length)
+	{
+		size_t next_bound {no_bound};
+		auto search {[&](auto& self, game_state& board) -> void {
+			checkpoint.board_expanded(possible_solution.size());
+			while (auto next_move {board.next_possible_move(options.reduce_move_orders)})
+			{
+				const auto& move {*next_move};
+				if (solutions.size() == options.max_solutions)
+				{
+					return;
+				}
+
+				auto child {board.generate_new_board_from_move(move)};
+				if (std::find(hashes_on_path.begin(), hashes_on_path.end(), child.hash) != hashes_on_path.end())
+				{
+					continue; // going round in a circle
+				}
+
+				possible_solution.push_back(move);
+				if (child.is_solved())
+				{
+					solutions.push_back(possible_solution);
+				}
+				else
+				{
+					auto estimate {possible_solution.size() + child.lower_bound_on_moves_left()};
+					if (estimate > bound)
+					{
+						next_bound = (std::min)(next_bound, estimate);
+					}
+					else
+					{
+						hashes_on_path.push_back(child.hash);
+						self(self, child);
+						hashes_on_path.pop_back();
+					}
+				}
+				possible_solution.pop_back();
+			}
+		}};
+
+		auto start {given_state.fresh_copy()};
+		search(search, start);
+		bound = next_bound;
+	}
+	checkpoint.finish();
+	return solutions;
+}
+
+// Each worker owns a deque of tasks and takes from its back. A worker that runs dry steals from the front of someone else's,
+// which is where the oldest, and so usually biggest, subtrees are.
+template <typename task>
+class work_stealing_queues
+{
+public:
+	work_stealing_queues(size_t workers) : queues(workers)
+	{}
+	void push(size_t worker, task&& work)
+	{
+		std::lock_guard lock {queues[worker].mutex};
+		queues[worker].tasks.push_back(std::move(work));
+	}
+	std::optional<task> pop_or_steal(size_t worker)
+	{
+		for (size_t i {0}; i < queues.size(); ++i)
+		{
+			auto& queue {queues[(worker + i) % queues.size()]};
+			std::lock_guard lock {queue.mutex};
+			if (!queue.tasks.empty())
+			{
+				std::optional<task> work;
+				if (i == 0)
+				{
+					work.emplace(std::move(queue.tasks.back()));
+					queue.tasks.pop_back();
+				}
+				else
+				{
+					work.emplace(std::move(queue.tasks.front()));
+					queue.tasks.pop_front();
+				}
+				return work;
+			}
+		}
+		return std::nullopt;
+	}
+private:
+	struct queue
+	{
+		std::mutex mutex;
+		std::deque<task> tasks;
+	};
+	std::vector<queue> queues;
+};
+
+// Solutions from every thread end up here. The shortest length so far doubles as the bound all the threads prune against.
+class solution_collector
+{
+public:
+	std::atomic<size_t> length_of_shortest_solution_so_far;
+	solution_collector(size_t max_solutions, size_t max_solution_length) : length_of_shortest_solution_so_far {max_solution_length}, max_solutions {max_solutions}
+	{}
+	void add(const std::vector<move>& moves)
+	{
+		std::lock_guard lock {mutex};
+		if (moves.size() > length_of_shortest_solution_so_far)
+		{
+			return;
+		}
+		if (moves.size() < length_of_shortest_solution_so_far)
+		{
+			solutions.clear();
+			length_of_shortest_solution_so_far = moves.size();
+		}
+		if (solutions.size() < max_solutions)
+		{
+			solutions.push_back(moves);
+		}
+	}
+	std::vector<solution> take_solutions()
+	{
+		std::lock_guard lock {mutex};
+		return std::move(solutions);
+	}
+private:
+	std::mutex mutex;
+	std::vector<solution> solutions;
+	size_t max_solutions;
+};
+
+std::vector<solution> game_state::work_out_all_solutions_in_parallel(const game_state& given_state, const search_options& options)
+{
+	// the same depth-first search as work_out_all_solutions, split into subtrees a few moves down and shared out between threads.
+	// They all prune against the shortest solution any of them has found, and share one table of examined boards.
+
+	const size_t thread_count {options.threads != 0 ? options.threads : (std::max)(size_t {1}, static_cast<size_t>(std::thread::hardware_concurrency()))};
+	const size_t enough_tasks {thread_count * 32};
+
+	struct task
+	{
+		game_state board; // its move generator hasn't been started
+		std::vector<move> path;
+	};
+
+	concurrent_transposition_table examined_boards {transposition_table_bytes_for(given_state, options)};
+	const size_t max_solution_length {(std::min)(options.max_solution_length, concurrent_transposition_table::longest_path)};
+	solution_collector collector {options.max_solutions, max_solution_length};
+	work_stealing_queues<task> queues {thread_count};
+
+	// The workers each count the boards they expand and only add them to the shared count, and look at the clock,
+	// every so many boards, so the board budget can overshoot by up to that many per worker.
+	constexpr std::uint64_t boards_between_checks {4096};
+	std::atomic<std::uint64_t> boards_expanded {0};
+	std::atomic<const char*> interrupted_because {nullptr};
+	auto check {[&](std::uint64_t& boards_since_check) {
+		if (++boards_since_check < boards_between_checks)
+		{
+			return;
+		}
+		const char* reason {nullptr};
+		if (options.cancellation && options.cancellation->is_cancelled())
+		{
+			reason = "cancelled";
+		}
+		else if (boards_expanded.fetch_add(boards_since_check, std::memory_order_relaxed) + boards_since_check > options.max_boards_expanded)
+		{
+			reason = "ran out of boards";
+		}
+		else if (std::chrono::steady_clock::now() > options.deadline)
+		{
+			reason = "ran out of time";
+		}
+		boards_since_check = 0;
+		if (reason)
+		{
+			const char* none {nullptr};
+			interrupted_because.compare_exchange_strong(none, reason);
+		}
+	}};
+
+	// Returns false for a child that doesn't need searching: it's finished (and has been collected), it's a loser,
+	// or it's already been reached by a path at least as short.
+	auto worth_searching {[&](game_state& child, std::vector<move>& path_to_child, bool& generated_a_solution) {
+		if (child.is_solved())
+		{
+			collector.add(path_to_child);
+			generated_a_solution = true;
+			return false;
+		}
+		return child.has_a_possible_move(options.reduce_move_orders) && !examined_boards.has_already_been_examined(child.dedup_key(options), path_to_child.size());
+	}};
+
+	auto search {[&](auto& self, game_state& board, std::vector<move>& path, std::uint64_t& boards_since_check) -> void {
+		if (path.size() >= collector.length_of_shortest_solution_so_far.load(std::memory_order_relaxed) ||
+			interrupted_because.load(std::memory_order_relaxed))
+		{
+			return; // anything found below here would be longer than a solution we already have, or we're giving up
+		}
+		check(boards_since_check);
+		bool generated_a_solution {false};
+		while (auto next_move {board.next_possible_move(options.reduce_move_orders)})
+		{
+			const auto& move {*next_move};
+			auto child {board.generate_new_board_from_move(move)};
+			path.push_back(move);
+			if (worth_searching(child, path, generated_a_solution) && !generated_a_solution)
+			{
+				self(self, child, path, boards_since_check);
+			}
+			path.pop_back();
+		}
+	}};
+
+	// split the top of the tree breadth first until there's plenty to share around
+	auto root {given_state.fresh_copy()};
+	if (root.is_solved())
+	{
+		throw std::runtime_error("this state is already solved");
+	}
+	static_cast<void>(examined_boards.has_already_been_examined(root.dedup_key(options), 0));
+
+	std::deque<task> tasks;
+	tasks.push_back({root, {}});
+	while (!tasks.empty() && tasks.size() < enough_tasks && tasks.front().path.size() < max_solution_length)
+	{
+		auto parent {std::move(tasks.front())};
+		tasks.pop_front();
+		bool generated_a_solution {false};
+		size_t children_queued {0};
+		while (auto next_move {parent.board.next_possible_move(options.reduce_move_orders)})
+		{
+			const auto& move {*next_move};
+			auto child {parent.board.generate_new_board_from_move(move)};
+			auto path {parent.path};
+			path.push_back(move);
+			if (worth_searching(child, path, generated_a_solution))
+			{
+				tasks.push_back({std::move(child), std::move(path)});
+				children_queued++;
+			}
+		}
+		if (generated_a_solution)
+		{
+			// as in the sequential search, nothing below a board that finishes in one more move can be as short
+			tasks.erase(tasks.end() - children_queued, tasks.end());
+		}
+	}
+
+	for (size_t i {0}; i < tasks.size(); ++i)
+	{
+		queues.push(i % thread_count, std::move(tasks[i]));
+	}
+
+	std::vector<std::thread> workers;
+	for (size_t worker {0}; worker < thread_count; ++worker)
+	{
+		workers.emplace_back([&, worker] {
+			std::uint64_t boards_since_check {0};
+			while (auto work {queues.pop_or_steal(worker)})
+			{
+				search(search, work->board, work->path, boards_since_check);
+			}
+		});
+	}
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+	if (auto reason {interrupted_because.load()})
+	{
+		throw search_interrupted(reason);
+	}
+
+	return collector.take_solutions();
+}
+
+solution& work_out_best_solution(std::vector<solution>& solutions)
+{
+	size_t index_of_best_solution {};
+	size_t shortest_solution_length_so_far {};
+	for (size_t i {0}; i < solutions.size(); i++)
+	{
+		if (i == 0)
+		{
+			shortest_solution_length_so_far = solutions[i].moves.size();
+			index_of_best_solution = i;
+		}
+		else
+		{
+			auto this_solution_length {solutions[i].moves.size()};
+			if (this_solution_length < shortest_solution_length_so_far)
+			{
+				shortest_solution_length_so_far = this_solution_length;
+				index_of_best_solution = i;
+			}
+		}
+	}
+	return solutions[index_of_best_solution];
+}
+
+void report_best_solution(const std::vector<solution>& solutions)
+{
+	auto& best_solution {solutions.front()};
+
+	std::cout << "found [" << solutions.size() << "] [" << best_solution.moves.size() << "] length solutions. One is: " << std::endl;
+	std::cout << best_solution;
+}
+
+const game_state level_50 {{
+	{magenta, yellow, dark_green, orange},
+	{yellow, dark_blue, cream, dark_blue},
+	{light_blue, pink, dark_blue, light_green},
+	{light_blue, pink, magenta, cream},
+	{yellow, light_blue, magenta, dark_blue},
+	{yellow, light_green, light_green, light_green},
+	{cream, pink, dark_green, light_blue},
 	{pink, orange, dark_green, orange},
 	{cream, dark_green, orange, magenta},
 	{empty, empty, empty, empty},
 	{empty, empty, empty, empty}
 	}};
 
-void do_the_thing()
-{
-	game_state g {level_50};
+void do_the_thing()
+{
+	game_state g {level_50};
+
+	search_statistics statistics;
+	search_options options;
+	options.statistics = &statistics;
+	options.on_progress = [](const search_statistics& so_far) { std::clog << so_far << std::endl; };
+	auto solutions {game_state::work_out_all_solutions_in_place(g, options)};
+	std::clog << statistics << std::endl;
+	if (solutions.empty())
+	{
+		std::cout << "didn't find a solution";
+	}
+	else
+	{
+		report_best_solution(solutions);
+	}
+	std::cout << std::endl;
+}
+
+colour colour_from_name(std::string name)
+{
+	// the names the colours are printed with, or their names in the code. Printing them is slow, so it's only done once.
+	static const auto printed_names {[] {
+		std::array<std::string, yellow + 1> names;
+		for (int value {empty}; value <= yellow; ++value)
+		{
+			std::ostringstream printed;
+			printed << static_cast<colour>(value);
+			names[value] = printed.str();
+		}
+		return names;
+	}()};
+	std::replace(name.begin(), name.end(), '_', ' ');
+	for (int value {empty}; value <= yellow; ++value)
+	{
+		if (printed_names[value] == name)
+		{
+			return static_cast<colour>(value);
+		}
+	}
+	throw std::runtime_error("there's no colour called " + name);
+}
+
+// A level written on one line, for the batch mode:
+//     level_50: magenta yellow dark_green orange | yellow dark_blue cream dark_blue | ... | empty empty empty empty
+// The name and its colon are optional. Tubes are separated by |, and each tube lists its slots from the bottom up,
+// separated by spaces or commas. Blank lines and lines starting with # aren't levels.
+class level
+{
+public:
+	std::string name;
+	game_state board;
+	static std::optional<level> parse(const std::string& line, const std::string& default_name)
+	{
+		auto first {line.find_first_not_of(" \t\r")};
+		if (first == std::string::npos || line[first] == '#')
+		{
+			return std::nullopt;
+		}
+
+		std::string name {default_name};
+		std::string tubes_text {line};
+		if (auto colon {line.find(':')}; colon != std::string::npos)
+		{
+			std::istringstream name_text {line.substr(0, colon)};
+			name_text >> name;
+			tubes_text = line.substr(colon + 1);
+		}
+
+		std::vector<std::vector<colour>> tubes;
+		std::istringstream tubes_stream {tubes_text};
+		std::string tube_text;
+		while (std::getline(tubes_stream, tube_text, '|'))
+		{
+			std::replace(tube_text.begin(), tube_text.end(), ',', ' ');
+			std::istringstream slots {tube_text};
+			std::vector<colour> tube;
+			std::string colour_name;
+			while (slots >> colour_name)
+			{
+				tube.push_back(colour_from_name(colour_name));
+			}
+			if (tube.empty())
+			{
+				throw std::runtime_error("a tube with no slots");
+			}
+			tubes.push_back(tube);
+		}
+		return level {name, game_state {tubes}};
+	}
+};
+
+// Levels by the million, packed and read in place. The file is:
+//     a header
+//     an index: where each level starts, a word each, and one more word where the last one ends
+//     the levels, each its tube count, a byte, then each tube's capacity, a byte each,
+//     then every slot of every tube, tube after tube from the bottom up, 4 bits each (the low half of a byte first), padded out to a byte
+// The whole file is checked when it's opened, so reading a level back is only unpacking it, with nothing allocated.
+class level_corpus
+{
+public:
+	class header
+	{
+	public:
+		std::uint64_t magic {file_magic};
+		std::uint32_t version {file_version};
+		std::uint32_t unused {};
+		std::uint64_t levels {};
+	};
+	static constexpr std::uint64_t file_magic {0x43564c2d776f6c66}; // "flow-LVC"
+	static constexpr std::uint32_t file_version {1};
+
+	level_corpus(const std::filesystem::path& path) : file {path}
+	{
+		auto contents {file.contents()};
+		if (contents.size() < sizeof(header))
+		{
+			throw std::runtime_error(path.string() + " isn't a level corpus");
+		}
+		std::memcpy(&shape, contents.data(), sizeof(header));
+		if (shape.magic != file_magic)
+		{
+			throw std::runtime_error(path.string() + " isn't a level corpus");
+		}
+		if (shape.version != file_version)
+		{
+			throw std::runtime_error(std::format("{} is version {} of the level corpus format, and this is version {}", path.string(), shape.version, file_version));
+		}
+		if (shape.levels >= (contents.size() - sizeof(header)) / sizeof(std::uint64_t))
+		{
+			throw std::runtime_error(path.string() + " has been cut short");
+		}
+		index = file.words().subspan(sizeof(header) / sizeof(std::uint64_t), shape.levels + 1);
+		levels = contents;
+		for (size_t i {0}; i < shape.levels; ++i)
+		{
+			if (auto problem {check(i)}; !problem.empty())
+			{
+				throw std::runtime_error(std::format("level {} of {} {}", i, path.string(), problem));
+			}
+		}
+	}
+	size_t size() const { return shape.levels; }
+	game_state board(size_t i) const
+	{
+		auto level {levels.subspan(index[i], index[i + 1] - index[i])};
+		auto tube_count {level[0]};
+		auto capacities {level.subspan(1, tube_count)};
+		auto cells {level.subspan(1 + tube_count)};
+		std::array<std::uint64_t, max_tube_count> contents {};
+		size_t cell {0};
+		for (size_t t {0}; t < tube_count; ++t)
+		{
+			for (size_t slot {0}; slot < capacities[t]; ++slot, ++cell)
+			{
+				contents[t] |= static_cast<std::uint64_t>((cells[cell / 2] >> (cell % 2 * bits_per_slot)) & slot_mask) << (slot * bits_per_slot);
+			}
+		}
+		return game_state::from_packed_tubes(capacities, {contents.data(), tube_count});
+	}
+	static void write(const std::filesystem::path& path, std::istream& text)
+	{
+		// from levels in the batch syntax, one per line. Their names aren't kept: a level in a corpus is known by its place in it.
+		std::vector<std::uint64_t> starts;
+		std::vector<std::uint8_t> packed;
+		std::string line;
+		for (size_t line_number {1}; std::getline(text, line); ++line_number)
+		{
+			std::optional<level> parsed;
+			try
+			{
+				parsed = level::parse(line, "");
+			}
+			catch (const std::exception& e)
+			{
+				throw std::runtime_error(std::format("line {}: {}", line_number, e.what()));
+			}
+			if (!parsed)
+			{
+				continue;
+			}
+			starts.push_back(packed.size());
+			append(packed, parsed->board);
+		}
+		starts.push_back(packed.size());
+
+		header shape {};
+		shape.levels = starts.size() - 1;
+		auto levels_start {sizeof(header) + starts.size() * sizeof(std::uint64_t)};
+		for (auto& start : starts)
+		{
+			start += levels_start;
+		}
+		std::ofstream out {path, std::ios::binary};
+		out.write(reinterpret_cast<const char*>(&shape), sizeof(shape));
+		out.write(reinterpret_cast<const char*>(starts.data()), starts.size() * sizeof(std::uint64_t));
+		out.write(reinterpret_cast<const char*>(packed.data()), packed.size());
+		if (!out)
+		{
+			throw std::runtime_error("can't write " + path.string());
+		}
+	}
+	static void append(std::vector<std::uint8_t>& packed, const game_state& board)
+	{
+		packed.push_back(static_cast<std::uint8_t>(board.tube_count));
+		for (const auto& tube : board.tubes())
+		{
+			packed.push_back(tube.capacity);
+		}
+		size_t cell {0};
+		for (const auto& tube : board.tubes())
+		{
+			for (size_t slot {0}; slot < tube.capacity; ++slot, ++cell)
+			{
+				if (cell % 2 == 0)
+				{
+					packed.push_back(0);
+				}
+				packed.back() |= static_cast<std::uint8_t>(tube.colour_at(slot) << (cell % 2 * bits_per_slot));
+			}
+		}
+	}
+private:
+	mapped_file file;
+	header shape {};
+	std::span<const std::uint64_t> index;
+	std::span<const std::uint8_t> levels; // the whole file, which the index counts from
+
+	std::string check(size_t i) const
+	{
+		// what's wrong with level i, if anything: everything board relies on, and that it could be solved at all by the look of it
+		if (index[i] < sizeof(header) + index.size_bytes() || index[i] >= index[i + 1] || index[i + 1] > levels.size())
+		{
+			return "is out of place";
+		}
+		auto level {levels.subspan(index[i], index[i + 1] - index[i])};
+		size_t tube_count {level[0]};
+		if (tube_count == 0 || tube_count > max_tube_count || level.size() < 1 + tube_count)
+		{
+			return std::format("has {} tubes", tube_count);
+		}
+		auto capacities {level.subspan(1, tube_count)};
+		size_t slots {0};
+		for (auto capacity : capacities)
+		{
+			if (capacity == 0 || capacity > max_tube_capacity)
+			{
+				return std::format("has a tube that holds {}", capacity);
+			}
+			slots += capacity;
+		}
+		if (level.size() != 1 + tube_count + (slots + 1) / 2)
+		{
+			return "isn't the size its tubes make it";
+		}
+
+		auto cells {level.subspan(1 + tube_count)};
+		std::array<size_t, colours_per_slot> pieces {};
+		size_t cell {0};
+		for (auto capacity : capacities)
+		{
+			bool emptied {false};
+			for (size_t slot {0}; slot < capacity; ++slot, ++cell)
+			{
+				auto c {static_cast<size_t>((cells[cell / 2] >> (cell % 2 * bits_per_slot)) & slot_mask)};
+				if (c > yellow)
+				{
+					return std::format("has a colour {}, and there's no such colour", c);
+				}
+				if (c != empty && emptied)
+				{
+					return "has a colour floating above an empty space";
+				}
+				emptied = c == empty;
+				pieces[c]++;
+			}
+		}
+		if (std::all_of(capacities.begin(), capacities.end(), [&](auto capacity) { return capacity == capacities[0]; }))
+		{
+			for (size_t c {1}; c < pieces.size(); ++c)
+			{
+				if (pieces[c] % capacities[0] != 0)
+				{
+					std::ostringstream name;
+					name << static_cast<colour>(c);
+					return std::format("has {} of {}, which doesn't fill tubes of {}", pieces[c], name.str(), capacities[0]);
+				}
+			}
+		}
+		return {};
+	}
+};
+
+class batch_options
+{
+public:
+	size_t threads {0}; // 0 is one per core
+	std::chrono::milliseconds time_limit {0}; // per level, 0 is no limit
+	size_t memory_limit_bytes {size_t {64} << 20}; // per level: its transposition table is sized to suit it, up to this
+	std::uint64_t max_boards_expanded {std::numeric_limits<std::uint64_t>::max()}; // per level
+	size_t max_pours {user_defined_max_solution_length};
+	std::filesystem::path external_directory; // when it's set, levels are only proved, by the breadth-first search with its layers in here
+	std::filesystem::path pattern_database_file; // searched with, for the levels it fits, when it's set
+	std::filesystem::path cache_file; // levels are looked up in here before they're searched, and added once they're solved, when it's set
+};
+
+// Where a batch's levels come from. It's called by every worker, at the same time, for the next level: it names it,
+// and gives its board, or no board for a line that isn't a level. It returns false when there are no more,
+// and throws for a level that's wrong, which is reported under the name it already gave.
+using level_source = std::function<bool(std::string& name, std::optional<game_state>& board)>;
+
+void solve_levels(const level_source& next_level, std::ostream& output, const batch_options& options)
+{
+	// Each worker takes the next level, solves it, and writes its result straight away, so results come out
+	// in the order they finish rather than the order they went in, each one labelled with its level's name.
+	std::mutex output_mutex;
+	std::optional<pattern_database> patterns; // one mapping for all the workers
+	if (!options.pattern_database_file.empty())
+	{
+		patterns.emplace(options.pattern_database_file);
+	}
+	std::optional<solution_cache> cache; // shared the same way
+	if (!options.cache_file.empty())
+	{
+		cache.emplace(options.cache_file);
+	}
+
+	auto report {[&](const std::string& name, const std::string& result) {
+		std::lock_guard lock {output_mutex};
+		output << name << ": " << result << std::endl; // flushed, so whatever is reading us sees each result as soon as it's ready
+	}};
+
+	auto worker {[&] {
+		while (true)
+		{
+			std::string name;
+			std::optional<game_state> board;
+			try
+			{
+				if (!next_level(name, board))
+				{
+					return;
+				}
+				if (!board)
+				{
+					continue;
+				}
+				if (board->is_solved())
+				{
+					report(name, "already solved");
+					continue;
+				}
+
+				search_options search;
+				search.memory_limit_bytes = options.memory_limit_bytes; // the table is sized to the level up to this, and so is counting its solutions for the cache
+				search.max_boards_expanded = options.max_boards_expanded;
+				search.max_solution_length = options.max_pours;
+				search.take_safe_moves = true; // one shortest solution is all a level reports
+				search.patterns = patterns && patterns->fits(*board) ? &*patterns : nullptr;
+				search.cache = cache ? &*cache : nullptr;
+				if (options.time_limit.count() != 0)
+				{
+					search.deadline = std::chrono::steady_clock::now() + options.time_limit;
+				}
+
+				if (!options.external_directory.empty())
+				{
+					if (auto cached {cache ? cache->find(*board) : std::nullopt})
+					{
+						report(name, std::format("shortest is {} pours (from the cache)", cached->best.moves.size()));
+						continue;
+					}
+					auto length {game_state::work_out_shortest_length_externally(*board, options.external_directory, search)};
+					report(name, length ? std::format("shortest is {} pours", *length) : "no solution");
+					continue;
+				}
+
+				// a level that runs into a limit still reports the best it found on the way, marked as maybe not the shortest
+				auto result {game_state::work_out_best_solution_anytime(*board, search)};
+				if (!result.best)
+				{
+					report(name, result.stopped_because.empty() ? std::string {"no solution"} : "gave up, " + result.stopped_because);
+				}
+				else
+				{
+					std::ostringstream text;
+					text << result.best->moves.size() << " pours ";
+					if (!result.proven_shortest)
+					{
+						text << "(maybe not the shortest, " << result.stopped_because << ") ";
+					}
+					else if (result.from_cache)
+					{
+						text << "(from the cache) ";
+					}
+					result.best->display(text);
+					auto line {text.str()};
+					line.pop_back(); // display ends the line itself
+					report(name, line);
+				}
+			}
+			catch (const search_interrupted& e)
+			{
+				report(name, std::string {"gave up, "} + e.what());
+			}
+			catch (const std::exception& e)
+			{
+				report(name, std::string {"error, "} + e.what());
+			}
+		}
+	}};
+
+	size_t thread_count {options.threads != 0 ? options.threads : (std::max)(size_t {1}, static_cast<size_t>(std::thread::hardware_concurrency()))};
+	std::vector<std::thread> workers;
+	for (size_t i {0}; i < thread_count; ++i)
+	{
+		workers.emplace_back(worker);
+	}
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+void solve_batch(std::istream& input, std::ostream& output, const batch_options& options)
+{
+	// levels one per line. Only the lines being solved are ever held in memory.
+	std::mutex input_mutex;
+	size_t lines_read {0};
+	solve_levels([&](std::string& name, std::optional<game_state>& board) {
+		std::string line;
+		{
+			std::lock_guard lock {input_mutex};
+			if (!std::getline(input, line))
+			{
+				return false;
+			}
+			name = std::format("line {}", ++lines_read);
+		}
+		if (auto parsed {level::parse(line, name)})
+		{
+			name = parsed->name;
+			board.emplace(parsed->board);
+		}
+		return true;
+	}, output, options);
+}
+
+void solve_batch(const level_corpus& corpus, std::ostream& output, const batch_options& options)
+{
+	// levels straight out of the corpus's mapping, known by their place in it
+	std::atomic<size_t> levels_taken {0};
+	solve_levels([&](std::string& name, std::optional<game_state>& board) {
+		auto i {levels_taken++};
+		if (i >= corpus.size())
+		{
+			return false;
+		}
+		name = std::format("level {}", i);
+		board.emplace(corpus.board(i));
+		return true;
+	}, output, options);
+}
+
+size_t number_after(const std::vector<std::string>& arguments, size_t& i)
+{
+	// for a command line option that takes a number: reads it and moves past it
+	if (i + 1 == arguments.size())
+	{
+		throw std::runtime_error(arguments[i] + " needs a number after it");
+	}
+	return static_cast<size_t>(std::stoull(arguments[++i]));
+}
+
+std::string text_after(const std::vector<std::string>& arguments, size_t& i)
+{
+	// the same for an option that takes a file or directory
+	if (i + 1 == arguments.size())
+	{
+		throw std::runtime_error(arguments[i] + " needs a name after it");
+	}
+	return arguments[++i];
+}
+
+int batch_main(const std::vector<std::string>& arguments)
+{
+	// solve-waterflow --batch [file] [--threads n] [--time-limit-ms n] [--memory-limit-mb n] [--max-boards n] [--max-pours n] [--external dir] [--pattern-database file] [--cache file] [--corpus file]
+	// with no file, or a file of -, the levels are read from stdin, unless they're in a corpus
+	batch_options options;
+	std::string file_name {"-"};
+	std::filesystem::path corpus_name;
+	try
+	{
+		for (size_t i {1}; i < arguments.size(); ++i)
+		{
+			const auto& argument {arguments[i]};
+			auto number {[&] { return number_after(arguments, i); }};
+
+			if (argument == "--threads")
+			{
+				options.threads = number();
+			}
+			else if (argument == "--time-limit-ms")
+			{
+				options.time_limit = std::chrono::milliseconds {number()};
+			}
+			else if (argument == "--memory-limit-mb")
+			{
+				options.memory_limit_bytes = number() << 20;
+			}
+			else if (argument == "--max-boards")
+			{
+				options.max_boards_expanded = number();
+			}
+			else if (argument == "--max-pours")
+			{
+				options.max_pours = number();
+			}
+			else if (argument == "--external")
+			{
+				options.external_directory = text_after(arguments, i);
+			}
+			else if (argument == "--pattern-database")
+			{
+				options.pattern_database_file = text_after(arguments, i);
+			}
+			else if (argument == "--cache")
+			{
+				options.cache_file = text_after(arguments, i);
+			}
+			else if (argument == "--corpus")
+			{
+				corpus_name = text_after(arguments, i);
+			}
+			else
+			{
+				file_name = argument;
+			}
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		std::cerr << "usage: solve-waterflow --batch [file] [--threads n] [--time-limit-ms n] [--memory-limit-mb n] [--max-boards n] [--max-pours n] [--external dir] [--pattern-database file] [--cache file] [--corpus file]" << std::endl;
+		return 1;
+	}
+
+	if (!corpus_name.empty())
+	{
+		try
+		{
+			level_corpus corpus {corpus_name};
+			solve_batch(corpus, std::cout, options);
+			return 0;
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << e.what() << std::endl;
+			return 1;
+		}
+	}
+	if (file_name == "-")
+	{
+		solve_batch(std::cin, std::cout, options);
+		return 0;
+	}
+	std::ifstream file {file_name};
+	if (!file)
+	{
+		std::cerr << "can't open " << file_name << std::endl;
+		return 1;
+	}
+	solve_batch(file, std::cout, options);
+	return 0;
+}
+
+// What the daemon reads and writes is a stream of frames: a 4-byte little-endian length, then that many bytes.
+// A request is a 4-byte id the reply will carry back, then a level in the batch syntax.
+// A reply is the request's id, a status byte, then for a solution a 2-byte pour count and a packed_move per pour,
+// or for an error its message.
+enum class reply_status : std::uint8_t
+{
+	shortest,
+	maybe_not_the_shortest, // ran into a limit first, so it's the best found by then
+	no_solution,
+	already_solved,
+	gave_up, // ran into a limit before finding any solution
+	error,
+};
+
+constexpr size_t max_frame_bytes {size_t {1} << 20}; // far more than any level, but a garbled length can't have us allocate gigabytes
+
+void put_little_endian(std::string& bytes, std::uint64_t value, size_t size)
+{
+	for (size_t i {0}; i < size; ++i)
+	{
+		bytes.push_back(static_cast<char>(value >> (i * 8)));
+	}
+}
+
+std::uint64_t get_little_endian(std::string_view bytes, size_t offset, size_t size)
+{
+	std::uint64_t value {0};
+	for (size_t i {0}; i < size; ++i)
+	{
+		value |= static_cast<std::uint64_t>(static_cast<std::uint8_t>(bytes[offset + i])) << (i * 8);
+	}
+	return value;
+}
+
+std::optional<std::string> read_frame(std::istream& input)
+{
+	// nothing at the end of the stream
+	char length_bytes[4];
+	if (!input.read(length_bytes, sizeof(length_bytes)))
+	{
+		return std::nullopt;
+	}
+	auto length {get_little_endian({length_bytes, sizeof(length_bytes)}, 0, sizeof(length_bytes))};
+	if (length > max_frame_bytes)
+	{
+		throw std::runtime_error(std::format("a frame of {} bytes, when none is more than {}", length, max_frame_bytes));
+	}
+	std::string frame(length, '\0');
+	if (!input.read(frame.data(), length))
+	{
+		throw std::runtime_error("the stream ended in the middle of a frame");
+	}
+	return frame;
+}
+
+void write_frame(std::ostream& output, std::string_view frame)
+{
+	std::string length;
+	put_little_endian(length, frame.size(), 4);
+	output << length << frame;
+	output.flush(); // whoever asked is waiting on it
+}
+
+class daemon_options
+{
+public:
+	size_t threads {0}; // 0 is one per core
+	size_t queue_length {0}; // requests waiting for a worker before reading more waits too. 0 is 4 per worker.
+	std::chrono::milliseconds time_limit {1000}; // per request, 0 is no limit. Somebody is waiting on each one.
+	size_t memory_limit_bytes {size_t {64} << 20}; // each worker's transposition table
+	std::uint64_t max_boards_expanded {std::numeric_limits<std::uint64_t>::max()}; // per request
+	size_t max_pours {user_defined_max_solution_length};
+	std::filesystem::path pattern_database_file; // searched with, for the levels it fits, when it's set
+	std::filesystem::path cache_file; // levels are looked up in here before they're searched, and added once they're solved, when it's set
+};
+
+// A pool of workers that stays up between requests, so each request costs only its search:
+// every worker keeps its transposition table, and they all share the pattern database and the cache.
+// The queue is bounded, and submit waits while it's full, so a client sending faster than the workers solve
+// is slowed down to their pace rather than piling requests up in memory.
+class solver_daemon
+{
+public:
+	using reply_callback = std::function<void(std::string reply)>;
+
+	solver_daemon(const daemon_options& options) : options {options}
+	{
+		if (!options.pattern_database_file.empty())
+		{
+			patterns.emplace(options.pattern_database_file);
+		}
+		if (!options.cache_file.empty())
+		{
+			cache.emplace(options.cache_file);
+		}
+		auto thread_count {options.threads != 0 ? options.threads : (std::max)(size_t {1}, static_cast<size_t>(std::thread::hardware_concurrency()))};
+		queue_length = options.queue_length != 0 ? options.queue_length : 4 * thread_count;
+		for (size_t i {0}; i < thread_count; ++i)
+		{
+			workers.emplace_back([this] { work(); });
+		}
+	}
+	solver_daemon(const solver_daemon&) = delete;
+	solver_daemon& operator=(const solver_daemon&) = delete;
+	~solver_daemon()
+	{
+		// the requests already queued are still answered
+		{
+			std::lock_guard lock {mutex};
+			stopping = true;
+		}
+		not_empty.notify_all();
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+	}
+	void submit(std::string request, reply_callback on_reply)
+	{
+		// on_reply is called from a worker, with the reply frame, once the request has been solved
+		std::unique_lock lock {mutex};
+		not_full.wait(lock, [&] { return queue.size() < queue_length; });
+		queue.push_back({std::move(request), std::move(on_reply)});
+		lock.unlock();
+		not_empty.notify_one();
+	}
+	std::string solve(std::string_view request, transposition_table& table) const
+	{
+		std::string reply;
+		if (request.size() < 4)
+		{
+			put_little_endian(reply, 0, 4);
+			reply.push_back(static_cast<char>(reply_status::error));
+			reply += "a request starts with its 4-byte id";
+			return reply;
+		}
+		put_little_endian(reply, get_little_endian(request, 0, 4), 4);
+		auto answer {[&](reply_status status) { reply.push_back(static_cast<char>(status)); }};
+
+		try
+		{
+			auto parsed {level::parse(std::string {request.substr(4)}, "request")};
+			if (!parsed)
+			{
+				throw std::runtime_error("there's no level in it");
+			}
+			if (parsed->board.is_solved())
+			{
+				answer(reply_status::already_solved);
+				return reply;
+			}
+
+			search_options search;
+			search.table = &table;
+			search.memory_limit_bytes = options.memory_limit_bytes; // the table's already made, so this only caps counting a level's solutions for the cache
+			search.max_boards_expanded = options.max_boards_expanded;
+			search.max_solution_length = options.max_pours;
+			search.take_safe_moves = true;
+			search.patterns = patterns && patterns->fits(parsed->board) ? &*patterns : nullptr;
+			search.cache = cache ? &*cache : nullptr;
+			if (options.time_limit.count() != 0)
+			{
+				search.deadline = std::chrono::steady_clock::now() + options.time_limit;
+			}
+
+			auto result {game_state::work_out_best_solution_anytime(parsed->board, search)};
+			if (!result.best)
+			{
+				answer(result.stopped_because.empty() ? reply_status::no_solution : reply_status::gave_up);
+				reply += result.stopped_because;
+				return reply;
+			}
+			answer(result.proven_shortest ? reply_status::shortest : reply_status::maybe_not_the_shortest);
+			put_little_endian(reply, result.best->moves.size(), 2);
+			for (const auto& move : result.best->moves)
+			{
+				put_little_endian(reply, packed_move {move}.bits, 2);
+			}
+		}
+		catch (const std::exception& e)
+		{
+			reply.resize(4);
+			answer(reply_status::error);
+			reply += e.what();
+		}
+		return reply;
+	}
+private:
+	class job
+	{
+	public:
+		std::string request;
+		reply_callback on_reply;
+	};
+
+	daemon_options options;
+	std::optional<pattern_database> patterns;
+	mutable std::optional<solution_cache> cache; // adding to it is the only thing solve changes
+	size_t queue_length {};
+	std::deque<job> queue;
+	bool stopping {false};
+	std::mutex mutex;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+	std::vector<std::thread> workers;
+
+	void work()
+	{
+		transposition_table table {options.memory_limit_bytes}; // this worker's own, allocated once and cleared for each request
+		while (true)
+		{
+			job next;
+			{
+				std::unique_lock lock {mutex};
+				not_empty.wait(lock, [&] { return stopping || !queue.empty(); });
+				if (queue.empty())
+				{
+					return;
+				}
+				next = std::move(queue.front());
+				queue.pop_front();
+			}
+			not_full.notify_one();
+			next.on_reply(solve(next.request, table));
+		}
+	}
+};
+
+void serve_stream(std::istream& input, std::ostream& output, solver_daemon& daemon)
+{
+	// Answers one client's requests, each as soon as it's solved, so replies can come back in another order than the requests
+	// went in, which is what the ids are for. Returns once the client has stopped sending and every reply has gone out.
+	std::mutex output_mutex;
+	std::condition_variable all_replied;
+	size_t outstanding {0};
+	auto reply_to_client {[&](std::string reply) {
+		std::lock_guard lock {output_mutex};
+		write_frame(output, reply);
+		outstanding--;
+		all_replied.notify_all();
+	}};
+
+	try
+	{
+		while (auto request {read_frame(input)})
+		{
+			{
+				std::lock_guard lock {output_mutex};
+				outstanding++;
+			}
+			daemon.submit(std::move(*request), reply_to_client);
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl; // a client that's out of step with the framing can't be answered any more
+	}
+	std::unique_lock lock {output_mutex};
+	all_replied.wait(lock, [&] { return outstanding == 0; });
+}
+
+#ifndef _WIN32
+// Reads or writes a socket through an iostream, a buffer at a time. Closes it when it's done with it.
+class descriptor_buffer : public std::streambuf
+{
+public:
+	descriptor_buffer(int descriptor) : descriptor {descriptor}
+	{
+		setg(buffer.data(), buffer.data(), buffer.data());
+		setp(buffer.data(), buffer.data() + buffer.size());
+	}
+	descriptor_buffer(const descriptor_buffer&) = delete;
+	descriptor_buffer& operator=(const descriptor_buffer&) = delete;
+	~descriptor_buffer()
+	{
+		sync();
+		close(descriptor);
+	}
+protected:
+	int_type underflow() override
+	{
+		auto got {read(descriptor, buffer.data(), buffer.size())};
+		if (got <= 0)
+		{
+			return traits_type::eof();
+		}
+		setg(buffer.data(), buffer.data(), buffer.data() + got);
+		return traits_type::to_int_type(buffer[0]);
+	}
+	int_type overflow(int_type c) override
+	{
+		if (sync() != 0)
+		{
+			return traits_type::eof();
+		}
+		if (!traits_type::eq_int_type(c, traits_type::eof()))
+		{
+			*pptr() = traits_type::to_char_type(c);
+			pbump(1);
+		}
+		return traits_type::not_eof(c);
+	}
+	int sync() override
+	{
+		for (auto next {pbase()}; next != pptr();)
+		{
+			auto written {write(descriptor, next, pptr() - next)};
+			if (written <= 0)
+			{
+				return -1;
+			}
+			next += written;
+		}
+		setp(buffer.data(), buffer.data() + buffer.size());
+		return 0;
+	}
+private:
+	int descriptor;
+	std::array<char, 4096> buffer {}; // one buffer is enough, because each one is only read or only written
+};
+
+void serve_socket(const std::filesystem::path& path, solver_daemon& daemon)
+{
+	// Listens on a Unix socket, serving each client that connects on a thread of its own until it hangs up.
+	// Every client shares the one pool of workers. Only returns if the socket can't be set up.
+	sockaddr_un address {};
+	address.sun_family = AF_UNIX;
+	if (path.string().size() >= sizeof(address.sun_path))
+	{
+		throw std::runtime_error(path.string() + " is too long for a socket name");
+	}
+	std::strcpy(address.sun_path, path.c_str());
+
+	auto listener {socket(AF_UNIX, SOCK_STREAM, 0)};
+	std::filesystem::remove(path); // what's left from the last time
+	if (listener < 0 || bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+	{
+		throw std::runtime_error("can't listen on " + path.string());
+	}
+	std::signal(SIGPIPE, SIG_IGN); // a client that hangs up before its reply is a failed write, not the end of the daemon
+
+	while (true)
+	{
+		auto client {accept(listener, nullptr, nullptr)};
+		if (client < 0)
+		{
+			continue;
+		}
+		std::thread {[client, &daemon] {
+			descriptor_buffer reading {client};
+			descriptor_buffer writing {dup(client)};
+			std::istream input {&reading};
+			std::ostream output {&writing};
+			serve_stream(input, output, daemon);
+		}}.detach();
+	}
+}
+#endif
+
+int daemon_main(const std::vector<std::string>& arguments)
+{
+	// solve-waterflow --daemon [--socket path] [--threads n] [--queue n] [--time-limit-ms n] [--memory-limit-mb n] [--max-boards n] [--max-pours n] [--pattern-database file] [--cache file]
+	// without a socket, it serves stdin and stdout until stdin ends
+	daemon_options options;
+	std::filesystem::path socket_path;
+	try
+	{
+		for (size_t i {1}; i < arguments.size(); ++i)
+		{
+			const auto& argument {arguments[i]};
+			auto number {[&] { return number_after(arguments, i); }};
+
+			if (argument == "--socket")
+			{
+				socket_path = text_after(arguments, i);
+			}
+			else if (argument == "--threads")
+			{
+				options.threads = number();
+			}
+			else if (argument == "--queue")
+			{
+				options.queue_length = number();
+			}
+			else if (argument == "--time-limit-ms")
+			{
+				options.time_limit = std::chrono::milliseconds {number()};
+			}
+			else if (argument == "--memory-limit-mb")
+			{
+				options.memory_limit_bytes = number() << 20;
+			}
+			else if (argument == "--max-boards")
+			{
+				options.max_boards_expanded = number();
+			}
+			else if (argument == "--max-pours")
+			{
+				options.max_pours = number();
+			}
+			else if (argument == "--pattern-database")
+			{
+				options.pattern_database_file = text_after(arguments, i);
+			}
+			else if (argument == "--cache")
+			{
+				options.cache_file = text_after(arguments, i);
+			}
+			else
+			{
+				throw std::runtime_error("what's " + argument + "?");
+			}
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		std::cerr << "usage: solve-waterflow --daemon [--socket path] [--threads n] [--queue n] [--time-limit-ms n] [--memory-limit-mb n] [--max-boards n] [--max-pours n] [--pattern-database file] [--cache file]" << std::endl;
+		return 1;
+	}
+
+	try
+	{
+		solver_daemon daemon {options};
+		if (socket_path.empty())
+		{
+#ifdef _WIN32
+			_setmode(_fileno(stdin), _O_BINARY); // the frames are binary, and text mode would mangle any 13s and 10s in them
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			std::ios::sync_with_stdio(false);
+			serve_stream(std::cin, std::cout, daemon);
+			return 0;
+		}
+#ifdef _WIN32
+		throw std::runtime_error("--socket is only there on systems with Unix sockets; use stdin and stdout");
+#else
+		serve_socket(socket_path, daemon);
+#endif
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+	}
+	return 1;
+}
+
+std::vector<std::vector<colour>> scramble_solved_board(std::uint64_t seed, size_t colours, size_t capacity, size_t empty_tubes, size_t backward_pours)
+{
+	// Starts from a solved board and pours backwards: each pour is one that the game would let you pour straight back,
+	// so the level can always be solved in at most backward_pours pours.
+	// It only uses splitmix64, never the standard library's distributions, so a seed makes the same level on every platform.
+	if (colours == 0 || colours > yellow)
+	{
+		throw std::runtime_error("there are only 9 colours");
+	}
+	if (colours + empty_tubes > max_tube_count || capacity == 0 || capacity > max_tube_capacity)
+	{
+		throw std::runtime_error("that board doesn't fit");
+	}
+
+	std::vector<std::vector<colour>> tubes;
+	for (size_t c {1}; c <= colours; ++c)
+	{
+		tubes.push_back(std::vector<colour>(capacity, static_cast<colour>(c)));
+	}
+	for (size_t e {0}; e < empty_tubes; ++e)
+	{
+		tubes.push_back(std::vector<colour>(capacity, empty));
+	}
+
+	auto random {[&](size_t bound) { return static_cast<size_t>(splitmix64(seed) % bound); }};
+	auto filled_slots {[](const std::vector<colour>& tube) { return static_cast<size_t>(std::find(tube.begin(), tube.end(), empty) - tube.begin()); }};
+
+	for (size_t pour {0}; pour < backward_pours; ++pour)
+	{
+		for (size_t attempt {0}; attempt < 100; ++attempt) // most pairs of tubes can't be poured between, so have a few goes
+		{
+			auto& from {tubes[random(tubes.size())]};
+			auto& to {tubes[random(tubes.size())]};
+			if (&from == &to)
+			{
+				continue;
+			}
+			auto from_filled {filled_slots(from)};
+			auto to_filled {filled_slots(to)};
+			if (from_filled == 0 || to_filled == capacity)
+			{
+				continue;
+			}
+			auto colour {from[from_filled - 1]};
+			if (to_filled != 0 && to[to_filled - 1] == colour)
+			{
+				continue; // pouring it back would take more than we put there
+			}
+			size_t run {1};
+			while (run < from_filled && from[from_filled - 1 - run] == colour)
+			{
+				run++;
+			}
+			auto size {1 + random((std::min)(run, capacity - to_filled))};
+			if (size == run && size != from_filled)
+			{
+				continue; // pouring it back has to land on the same colour, or on nothing
+			}
+			for (size_t i {0}; i < size; ++i)
+			{
+				to[to_filled + i] = colour;
+				from[from_filled - 1 - i] = empty;
+			}
+			break;
+		}
+	}
+
+	for (size_t i {tubes.size() - 1}; i > 0; --i)
+	{
+		std::swap(tubes[i], tubes[random(i + 1)]);
+	}
+	return tubes;
+}
+
+size_t peak_resident_bytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters {};
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+	return counters.PeakWorkingSetSize;
+#else
+	rusage usage {};
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return static_cast<size_t>(usage.ru_maxrss);
+#else
+	return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+class benchmark_options
+{
+public:
+	std::uint64_t seed {1};
+	size_t levels {20};
+	size_t colours {7};
+	size_t capacity {4};
+	size_t empty_tubes {2};
+	size_t backward_pours {60};
+	size_t memory_limit_bytes {size_t {16} << 20}; // the most each level's transposition table can take. It's sized to the level, and allocated and cleared inside the timing.
+	std::filesystem::path pattern_database_file; // searched with, when it's set
+	bool take_safe_moves {true};
+};
+
+void run_benchmark(const benchmark_options& options, std::ostream& output)
+{
+	// Solves generated levels one after another with the in-place search, so the numbers only measure the search.
+	// Level i is made from the seed plus i, so any level in a run can be made again on its own.
+	using clock = std::chrono::steady_clock;
+	auto milliseconds {[](clock::duration duration) { return std::chrono::duration<double, std::milli>(duration).count(); }};
+
+	std::optional<pattern_database> patterns;
+	if (!options.pattern_database_file.empty())
+	{
+		patterns.emplace(options.pattern_database_file);
+	}
+
+	search_statistics total;
+	clock::duration total_time {};
+	for (size_t i {0}; i < options.levels; ++i)
+	{
+		game_state board {scramble_solved_board(options.seed + i, options.colours, options.capacity, options.empty_tubes, options.backward_pours)};
+		if (board.is_solved())
+		{
+			output << std::format("level {}: the scramble came back solved\n", i);
+			continue;
+		}
+
+		search_statistics statistics;
+		search_options search;
+		search.statistics = &statistics;
+		search.memory_limit_bytes = options.memory_limit_bytes;
+		search.patterns = patterns ? &*patterns : nullptr;
+		search.take_safe_moves = options.take_safe_moves;
+		auto start {clock::now()};
+		std::optional<clock::time_point> first_solution;
+		size_t length {0};
+		game_state::stream_solutions_in_place(board, search, [&](std::span<const packed_move> moves) {
+			if (!first_solution)
+			{
+				first_solution = clock::now();
+			}
+			length = moves.size();
+			return true;
+		});
+		auto finish {clock::now()};
+
+		output << std::format("level {}: {} pours, {} boards, {:.1f} ms to the first solution, {:.1f} ms to the proven shortest, {:.2f} M boards/s\n",
+			i, length, statistics.boards_generated, first_solution ? milliseconds(*first_solution - start) : 0.0, milliseconds(finish - start),
+			statistics.boards_generated / (std::max)(milliseconds(finish - start), 1e-3) / 1000);
+
+		total.boards_generated += statistics.boards_generated;
+		total.boards_expanded += statistics.boards_expanded;
+		total_time += finish - start;
+	}
+
+	output << std::format("{} levels, {} boards in {:.1f} ms, {:.2f} M boards/s, peak resident {:.1f} MB\n",
+		options.levels, total.boards_generated, milliseconds(total_time), total.boards_generated / (std::max)(milliseconds(total_time), 1e-3) / 1000,
+		peak_resident_bytes() / (1024.0 * 1024.0));
+}
+
+int benchmark_main(const std::vector<std::string>& arguments)
+{
+	// solve-waterflow --benchmark [--seed n] [--levels n] [--colours n] [--height n] [--empty-tubes n] [--backward-pours n] [--memory-limit-mb n] [--pattern-database file] [--no-safe-moves]
+	benchmark_options options;
+	try
+	{
+		for (size_t i {1}; i < arguments.size(); ++i)
+		{
+			const auto& argument {arguments[i]};
+			auto number {[&] { return number_after(arguments, i); }};
+
+			if (argument == "--seed")
+			{
+				options.seed = number();
+			}
+			else if (argument == "--levels")
+			{
+				options.levels = number();
+			}
+			else if (argument == "--colours")
+			{
+				options.colours = number();
+			}
+			else if (argument == "--height")
+			{
+				options.capacity = number();
+			}
+			else if (argument == "--empty-tubes")
+			{
+				options.empty_tubes = number();
+			}
+			else if (argument == "--backward-pours")
+			{
+				options.backward_pours = number();
+			}
+			else if (argument == "--memory-limit-mb")
+			{
+				options.memory_limit_bytes = number() << 20;
+			}
+			else if (argument == "--pattern-database")
+			{
+				options.pattern_database_file = text_after(arguments, i);
+			}
+			else if (argument == "--no-safe-moves")
+			{
+				options.take_safe_moves = false;
+			}
+			else
+			{
+				throw std::runtime_error("don't know " + argument);
+			}
+		}
+		run_benchmark(options, std::cout);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		std::cerr << "usage: solve-waterflow --benchmark [--seed n] [--levels n] [--colours n] [--height n] [--empty-tubes n] [--backward-pours n] [--memory-limit-mb n] [--pattern-database file] [--no-safe-moves]" << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+namespace tests
+{
+game_state tiny_level()
+{
+	// 4 tubes and 6 pours: small enough to check every solution by hand, too small for any pruning to show
+	return {{
+	{magenta, orange, light_green},
+	{orange, light_green, orange},
+	{light_green, magenta, magenta},
+	{empty, empty, empty}
+	}};
+}
+
+game_state scrambled_level()
+{
+	// 5 colours in 7 tubes of 4 and 11 pours: big enough that the transposition table, the move order reductions and the bounds all cut something
+	return {scramble_solved_board(3, 5, 4, 2, 60)};
+}
+
+void test_get_colour_and_depth()
+{
+	{
+		test_tube top_light_green_1 {1, {orange, light_blue, magenta, light_green}};
+		auto [colour, depth] {top_light_green_1.get_colour_and_depth()};
+		if (colour != light_green || depth != 1)
+		{
+			::DebugBreak();
+		}
+	}
+
+	{
+		test_tube top_light_green_2 {1, {orange, light_blue, light_green, light_green}};
+		auto [colour, depth] {top_light_green_2.get_colour_and_depth()};
+		if (colour != light_green || depth != 2)
+		{
+			::DebugBreak();
+		}
+	}
+
+	{
+		test_tube mid_orange_1_after_empty_1 {1, {light_green, cream, orange, empty}};
+		auto [colour, depth] {mid_orange_1_after_empty_1.get_colour_and_depth()};
+		if (colour != orange || depth != 1)
+		{
+			::DebugBreak();
+		}
+	}
+
+	{
+		test_tube mid_cream_2_after_empty_2 {1, {cream, cream, empty, empty}};
+		auto [colour, depth] {mid_cream_2_after_empty_2.get_colour_and_depth()};
+		if (colour != cream || depth != 2)
+		{
+			::DebugBreak();
+		}
+	}
+}
+
+void test_pouring_colour()
+{
+	{
+		test_tube magenta_4 {1, {magenta, magenta, magenta, magenta}};
+		if (magenta_4.pouring_colour() != magenta)
+		{
+			::DebugBreak();
+		}
+	}
+
+	{
+		test_tube magenta_3_empty_1 {1, {magenta, magenta, magenta, empty}};
+		if (magenta_3_empty_1.pouring_colour() != magenta)
+		{
+			::DebugBreak();
+		}
+	}
+
+	{
+		test_tube orange_2_empty_2 {1, {orange, orange, empty, empty}};
+		if (orange_2_empty_2.pouring_colour() != orange)
+		{
+			::DebugBreak();
+		}
+	}
+
+	{
+		test_tube pink_1_empty_3 {1, {pink, empty, empty, empty}};
+		if (pink_1_empty_3.pouring_colour() != pink)
+		{
+			::DebugBreak();
+		}
+		if (pink_1_empty_3.is_empty())
+		{
+			::DebugBreak();
+		}
+	}
+
+	{
+		test_tube empty_4 {1, {empty, empty, empty, empty}};
+		if (empty_4.pouring_colour() != empty)
+		{
+			::DebugBreak();
+		}
+		if (!empty_4.is_empty())
+		{
+			::DebugBreak();
+		}
+
+	}
+}
+
+void test_tube_display()
+{
+	{
+		test_tube tube_1 {1, {orange, light_green, magenta, yellow}};
+		std::ostringstream ss;
+		ss << tube_1;
+		if (ss.str() != "{orange, light green, magenta, yellow}")
+		{
+			::DebugBreak();
+		}
+	}
+
+	{
+		test_tube tube_2 {1, {orange, light_green, magenta, empty}};
+		std::ostringstream ss;
+		ss << tube_2;
+		if (ss.str() != "{orange, light green, magenta, empty}")
+		{
+			::DebugBreak();
+		}
+	}
+
+	{
+		test_tube tube_3 {1, {empty, empty, empty, empty}};
+		std::ostringstream ss;
+		ss << tube_3;
+		if (ss.str() != "{empty, empty, empty, empty}")
+		{
+			::DebugBreak();
+		}
+	}
+}
+
+void test_generate_possible_moves()
+{
+	{
+		test_tube source {1, {orange, magenta, yellow, cream}};
+		test_tube dest {2, {orange, magenta, cream, empty}};
+		auto move {source.generate_move_to(dest)};
+
+		if (move.to.tube_index = !1 && move.from.tube_index != 2)
+		{
+			::DebugBreak();
+		}
+
+		if (move.move_size != 1)
+		{
+			::DebugBreak();
+		}
+	}
+
+	{
+		test_tube source {1, {orange, magenta, yellow, yellow}};
+		test_tube dest {2, {orange, magenta, yellow, empty}};
+		auto move {source.generate_move_to(dest)};
+
+		if (move.to.tube_index = !1 && move.from.tube_index != 2)
+		{
+			::DebugBreak();
+		}
+
+		if (move.move_size != 1)
+		{
+			::DebugBreak();
+		}
+	}
+
+	{
+		test_tube source {1, {orange, magenta, yellow, empty}};
+		test_tube dest {2, {orange, magenta, yellow, empty}};
+		auto move {source.generate_move_to(dest)};
+
+		if (move.to.tube_index = !1 && move.from.tube_index != 2)
+		{
+			::DebugBreak();
+		}
+
+		if (move.move_size != 1)
+		{
+			::DebugBreak();
+		}
+	}
+
+	{
+		test_tube source {1, {orange, magenta, yellow, yellow}};
+		test_tube dest {2, {orange, yellow, empty, empty}};
+		auto move {source.generate_move_to(dest)};
+
+		if (move.to.tube_index = !1 && move.from.tube_index != 2)
+		{
+			::DebugBreak();
+		}
+
+		if (move.move_size != 2)
+		{
+			::DebugBreak();
+		}
+	}
+
+	{
+		test_tube source {1, {orange, magenta, magenta, yellow}};
+		test_tube dest {2, {empty, empty, empty, empty}};
+		auto move {source.generate_move_to(dest)};
+
+		if (move.to.tube_index = !1 && move.from.tube_index != 2)
+		{
+			::DebugBreak();
+		}
+
+		if (move.move_size != 1)
+		{
+			::DebugBreak();
+		}
+	}
+
+	{
+		test_tube source {1, {orange, magenta, yellow, cream}};
+		test_tube dest {2, {empty, empty, empty, empty}};
+		auto move {source.generate_move_to(dest)};
+
+		if (move.to.tube_index = !1 && move.from.tube_index != 2)
+		{
+			::DebugBreak();
+		}
+
+		if (move.move_size != 1)
+		{
+			::DebugBreak();
+		}
+	}
+}
+
+void test_work_out_all_solutions_1()
+{
+	game_state g
+	{{
+	{yellow, empty},
+	{yellow, empty}
+	}};
+
+	auto solutions {game_state::work_out_all_solutions(g)};
+
+	const solution solution_1 {{{1, 0, 1}}};
+	const solution solution_2 {{{0, 1, 1}}};
+
+	auto found_solution_1 {std::find(solutions.begin(), solutions.end(), solution_1)};
+	if (*found_solution_1 != solution_1)
+	{
+		::DebugBreak();
+	}
+
+	auto found_solution_2 {std::find(solutions.begin(), solutions.end(), solution_2)};
+	if (*found_solution_2 != solution_2)
+	{
+		::DebugBreak();
+	}
+
+	if (solutions.size() != 2)
+	{
+		::DebugBreak();
+	}
+}
+
+void test_work_out_all_solutions_2()
+{
+	game_state g
+	{{
+	{yellow, yellow, empty},
+	{yellow, empty, empty},
+	}};
+
+	auto solutions {game_state::work_out_all_solutions(g)};
+
+	const solution solution_1 {{{0, 1, 2}}};
+	const solution solution_2 {{{1, 0, 1}}};
+
+	auto found_solution_1 {std::find(solutions.begin(), solutions.end(), solution_1)};
+	if (*found_solution_1 != solution_1)
+	{
+		::DebugBreak();
+	}
+
+	auto found_solution_2 {std::find(solutions.begin(), solutions.end(), solution_2)};
+	if (*found_solution_2 != solution_2)
+	{
+		::DebugBreak();
+	}
+
+	if (solutions.size() != 2)
+	{
+		::DebugBreak();
+	}
+}
+
+void test_work_out_all_solutions_3()
+{
+	game_state g
+	{{
+	{yellow, yellow, empty},
+	{yellow, empty, empty},
+	{empty, empty, empty}
+	}};
+
+	auto solutions {game_state::work_out_all_solutions(g)};
+
+	const solution solution_1 {{{1, 0, 2}}};
+	const solution solution_2 {{{0, 1, 1}}};
+
+	std::vector<solution> expected_solutions {solution_1, solution_2};
+	for (const auto& solution : solutions)
+	{
+		auto found_solution {std::find(solutions.begin(), solutions.end(), solution)};
+		if (found_solution == solutions.end())
+		{
+			::DebugBreak();
+		}
+	}
+
+	if (solutions.size() != expected_solutions.size())
+	{
+		::DebugBreak();
+	}
+}
+
+void test_work_out_all_solutions_4()
+{
+	game_state g
+	{{
+	{magenta, orange, light_green},
+	{orange, light_green, orange},
+	{light_green, magenta, magenta},
+	{empty, empty, empty}
+	}};
+	// oh boy these get big real quick
+
+	auto solutions {game_state::work_out_all_solutions(g)};
+
+	const solution solution_1 {{{2, 3, 2}, {0, 2, 1}, {1, 0, 1}, {1, 2, 1}, {0, 1, 2}, {0, 3, 1}}};
+	const solution solution_2 {{{2, 3, 2}, {0, 2, 1}, {1, 0, 1}, {1, 2, 1}, {0, 1, 2}, {3, 0, 2}}};
+
+	const solution solution_3 {{{1, 3, 1}, {0, 1, 1}, {0, 3, 1}, {2, 0, 2}, {1, 2, 2}, {3, 1, 2}}};
+	const solution solution_4 {{{1, 3, 1}, {0, 1, 1}, {0, 3, 1}, {2, 0, 2}, {1, 2, 2}, {1, 3, 1}}};
+
+	const solution solution_5 {{{0, 3, 1}, {1, 0, 1}, {1, 3, 1}, {0, 1, 2}, {2, 0, 2}, {3, 2, 2}}}; // lol, computer generated
+	const solution solution_6 {{{0, 3, 1}, {1, 0, 1}, {1, 3, 1}, {0, 1, 2}, {2, 0, 2}, {2, 3, 1}}}; // lol, computer generated
+
+	std::vector<solution> expected_solutions {solution_1, solution_2, solution_3, solution_4, solution_5, solution_6};
+	for (const auto& solution : solutions)
+	{
+		auto found_solution {std::find(solutions.begin(), solutions.end(), solution)};
+		if (found_solution == solutions.end())
+		{
+			::DebugBreak();
+		}
+	}
+
+	if (solutions.size() != expected_solutions.size())
+	{
+		::DebugBreak();
+	}
+}
+
+void test_work_out_all_solutions()
+{
+	test_work_out_all_solutions_1();
+	test_work_out_all_solutions_2();
+	test_work_out_all_solutions_3();
+	test_work_out_all_solutions_4();
+}
+
+void test_work_out_all_solutions_in_place()
+{
+	auto g {tiny_level()};
+
+	// a pour and its undo leave the board exactly as it was
+	auto board {g};
+	auto before {board.hash};
+	auto undo {board.make_move({1, 3, 1})};
+	board.unmake_move(undo);
+	if (board.hash != before || board.test_tubes[1].contents != g.test_tubes[1].contents || board.test_tubes[3].contents != g.test_tubes[3].contents || board.test_tubes[3].pouring_colour() != empty)
+	{
+		::DebugBreak();
+	}
+
+	// it's the same search, so it finds the same solutions as the one that copies boards, here and on the boards of the tests above
+	const std::vector<game_state> boards {
+		g,
+		{{{yellow, empty}, {yellow, empty}}},
+		{{{yellow, yellow, empty}, {yellow, empty, empty}}},
+		{{{yellow, yellow, empty}, {yellow, empty, empty}, {empty, empty, empty}}}};
+	for (const auto& board : boards)
+	{
+		game_state copy {board};
+		if (game_state::work_out_all_solutions_in_place(board) != game_state::work_out_all_solutions(copy))
+		{
+			::DebugBreak();
+		}
+	}
+}
+
+void test_stream_solutions_in_place()
+{
+	auto g {tiny_level()};
+
+	auto all {game_state::work_out_all_solutions_in_place(g)};
+	auto count {game_state::count_solutions_found_in_place(g)};
+	if (count.length != 6 || count.found != all.size())
+	{
+		::DebugBreak();
+	}
+
+	// on a level where the search prunes, it comes to fewer of them than the level has, but never to a different length
+	auto bigger {scrambled_level()};
+	search_options small;
+	small.transposition_table_bytes = size_t {1} << 20;
+	auto found {game_state::count_solutions_found_in_place(bigger, small)};
+	auto dag {game_state::work_out_shortest_solution_dag(bigger, small)};
+	if (found.length != dag.length() || found.found == 0 || found.found >= dag.count())
+	{
+		::DebugBreak();
+	}
+
+	// every solution comes out as it's found, none longer than the one before
+	size_t previous_length {user_defined_max_solution_length};
+	size_t streamed {0};
+	game_state::stream_solutions_in_place(g, {}, [&](std::span<const packed_move> moves) {
+		if (moves.size() > previous_length || !g.is_solved_by(moves))
+		{
+			::DebugBreak();
+		}
+		previous_length = moves.size();
+		streamed++;
+		return true;
+	});
+	if (streamed < all.size())
+	{
+		::DebugBreak();
+	}
+
+	// the first one stops the search straight away, and doesn't have to be the shortest
+	auto first {game_state::work_out_first_solution_in_place(g)};
+	if (!first || !g.is_solved_by(*first))
+	{
+		::DebugBreak();
+	}
+}
+
+void test_safe_moves()
+{
+	game_state g
+	{{
+	{magenta, magenta, empty},
+	{orange, light_green, orange},
+	{magenta, empty, empty},
+	{light_green, orange, light_green},
+	{empty, empty, empty}
+	}};
+	// all the magenta is in two tubes of its own and fits in one, but the orange and the light green are mixed up
+	auto safe {g.safe_move(magenta)};
+	if (!safe || safe->move_size + g.test_tubes[safe->to.tube_index].filled_slots() != 3 || g.safe_move(orange) || g.safe_move(light_green))
+	{
+		::DebugBreak();
+	}
+
+	// taking them never costs a pour: the same length as a search that branches on everything, on levels with plenty of them
+	for (std::uint64_t seed {1}; seed <= 20; ++seed)
+	{
+		game_state board {scramble_solved_board(seed, 4, 3, 2, 40)};
+		if (board.is_solved())
+		{
+			continue;
+		}
+		search_options branching;
+		branching.transposition_table_bytes = size_t {1} << 20;
+		auto taking {branching};
+		taking.take_safe_moves = true;
+		auto taken {game_state::work_out_first_solution_in_place(board, taking)};
+		auto shortest {game_state::count_solutions_found_in_place(board, branching)};
+		auto best {game_state::work_out_best_solution_anytime(board, taking)};
+		if (!taken || !board.is_solved_by(*taken) || !best.best || best.best->moves.size() != shortest.length || !board.is_solved_by(*best.best))
+		{
+			::DebugBreak();
+		}
+	}
+}
+
+void test_with_fixed_tube_count()
+{
+	auto fixed {[](size_t tube_count) { return with_fixed_tube_count(tube_count, [](auto fixed_tube_count) { return decltype(fixed_tube_count)::value; }); }};
+	if (fixed(4) != 0 || fixed(5) != 5 || fixed(11) != 11 || fixed(16) != 16)
+	{
+		::DebugBreak();
+	}
+
+	// 5 tubes, so the in-place search runs with the count built in, and still finds what the copying search does
+	game_state g
+	{{
+	{magenta, orange, light_green},
+	{orange, light_green, orange},
+	{light_green, magenta, magenta},
+	{empty, empty, empty},
+	{empty, empty, empty}
+	}};
+	game_state copy {g};
+	if (game_state::work_out_all_solutions(copy) != game_state::work_out_all_solutions_in_place(g))
+	{
+		::DebugBreak();
+	}
+}
+
+void test_search_statistics()
+{
+	auto g {tiny_level()};
+
+	// the two depth-first searches look at the same boards in the same order, so they count the same
+	search_statistics copying;
+	search_options options;
+	options.statistics = &copying;
+	game_state copy {g};
+	auto solutions {game_state::work_out_all_solutions(copy, options)};
+
+	search_statistics in_place;
+	size_t progress_reports {0};
+	options.statistics = &in_place;
+	options.on_progress = [&](const search_statistics&) { progress_reports++; };
+	options.progress_interval = std::chrono::milliseconds {0};
+	static_cast<void>(game_state::work_out_all_solutions_in_place(g, options));
+
+	if (copying.boards_generated == 0 || copying.boards_generated != in_place.boards_generated ||
+		copying.boards_expanded != in_place.boards_expanded || copying.transposition_hits != in_place.transposition_hits ||
+		copying.transposition_reopens != in_place.transposition_reopens || copying.pruned_by_bound != in_place.pruned_by_bound ||
+		copying.dead_ends != in_place.dead_ends || copying.solutions_found < solutions.size() ||
+		copying.peak_depth != in_place.peak_depth || copying.table_bytes == 0)
+	{
+		::DebugBreak();
+	}
+	if (in_place.boards_expanded >= 4096 && progress_reports == 0)
+	{
+		::DebugBreak(); // it checks every 4096 boards, and with no interval it reports at every check
+	}
+}
+
+void test_anytime_solving()
+{
+	auto g {tiny_level()};
+
+	auto unlimited {game_state::work_out_best_solution_anytime(g)};
+	if (!unlimited.best || unlimited.best->moves.size() != 6 || !unlimited.proven_shortest || !unlimited.stopped_because.empty())
+	{
+		::DebugBreak();
+	}
+
+	// the board budget is exact: the first board past it stops the search
+	search_statistics statistics;
+	search_options budget;
+	budget.max_boards_expanded = 3;
+	budget.statistics = &statistics;
+	auto budgeted {game_state::work_out_best_solution_anytime(g, budget)};
+	if (budgeted.proven_shortest || budgeted.stopped_because != "ran out of boards" || statistics.boards_expanded != 4)
+	{
+		::DebugBreak();
+	}
+	if (budgeted.best && !g.is_solved_by(*budgeted.best))
+	{
+		::DebugBreak();
+	}
+
+	cancellation_token token;
+	token.cancel();
+	search_options cancelled;
+	cancelled.cancellation = &token;
+	auto cancelled_early {game_state::work_out_best_solution_anytime(g, cancelled)};
+	if (cancelled_early.best || cancelled_early.stopped_because != "cancelled")
+	{
+		::DebugBreak();
+	}
+
+	search_options too_late;
+	too_late.deadline = std::chrono::steady_clock::now() - std::chrono::seconds {1};
+	try
+	{
+		static_cast<void>(game_state::work_out_shortest_solutions_breadth_first(g, too_late));
+		::DebugBreak();
+	}
+	catch (const search_interrupted&)
+	{}
 
-	auto solutions {game_state::work_out_all_solutions(g)};
-	if (solutions.empty())
+	// nothing is looked for past max_solution_length, by any of the searches
+	search_options short_only;
+	short_only.max_solution_length = 5;
+	auto too_short {game_state::work_out_best_solution_anytime(g, short_only)};
+	if (too_short.best || !too_short.stopped_because.empty() ||
+		!game_state::work_out_shortest_solutions_breadth_first(g, short_only).empty() ||
+		!game_state::work_out_shortest_solutions_iterative_deepening(g, short_only).empty() ||
+		!game_state::work_out_all_solutions_in_parallel(g, short_only).empty())
 	{
-		std::cout << "didn't find a solution";
+		::DebugBreak();
 	}
-	else
+	short_only.max_solution_length = 6;
+	if (game_state::work_out_shortest_solutions_breadth_first(g, short_only).empty() ||
+		game_state::work_out_shortest_solutions_iterative_deepening(g, short_only).empty() ||
+		game_state::work_out_all_solutions_in_parallel(g, short_only).empty())
 	{
-		report_best_solution(solutions);
+		::DebugBreak();
 	}
-	std::cout << std::endl;
 }
 
-namespace tests
-{
-void test_get_colour_and_depth()
+void test_solution_cache()
 {
+	auto file {std::filesystem::temp_directory_path() / "solve-waterflow-tests.cache"};
+	std::filesystem::remove(file);
+	auto g {tiny_level()};
+	// the same level with its tubes in another order and magenta and orange swapped
+	game_state variant
+	{{
+	{empty, empty, empty},
+	{light_green, orange, orange},
+	{magenta, light_green, magenta},
+	{orange, magenta, light_green}
+	}};
+
+	search_options exact;
+	exact.canonicalize_tubes = false;
+	const auto shortest_solutions {game_state::work_out_shortest_solution_dag(g, exact).count()};
+
 	{
-		test_tube top_light_green_1 {1, {orange, light_blue, magenta, light_green}};
-		auto [colour, depth] {top_light_green_1.get_colour_and_depth()};
-		if (colour != light_green || depth != 1)
+		solution_cache cache {file};
+		search_options options;
+		options.cache = &cache;
+		auto searched {game_state::work_out_best_solution_anytime(g, options)};
+		if (searched.from_cache || !searched.proven_shortest || searched.best->moves.size() != 6 || searched.shortest_solutions != shortest_solutions || cache.size() != 1)
+		{
+			::DebugBreak();
+		}
+		auto looked_up {game_state::work_out_best_solution_anytime(g, options)};
+		if (!looked_up.from_cache || looked_up.best != searched.best || looked_up.shortest_solutions != shortest_solutions)
 		{
 			::DebugBreak();
 		}
-	}
 
-	{
-		test_tube top_light_green_2 {1, {orange, light_blue, light_green, light_green}};
-		auto [colour, depth] {top_light_green_2.get_colour_and_depth()};
-		if (colour != light_green || depth != 2)
+		// what's kept is the level's count, not the fewer solutions a search that prunes and takes safe pours comes to
+		auto bigger {scrambled_level()};
+		auto like_a_batch {options};
+		like_a_batch.take_safe_moves = true;
+		like_a_batch.transposition_table_bytes = size_t {1} << 20;
+		auto counted {game_state::work_out_best_solution_anytime(bigger, like_a_batch)};
+		if (counted.shortest_solutions != game_state::work_out_shortest_solution_dag(bigger, exact).count() || counted.solutions_found >= counted.shortest_solutions)
 		{
 			::DebugBreak();
 		}
 	}
 
 	{
-		test_tube mid_orange_1_after_empty_1 {1, {light_green, cream, orange, empty}};
-		auto [colour, depth] {mid_orange_1_after_empty_1.get_colour_and_depth()};
-		if (colour != orange || depth != 1)
+		// it's all still there when the file is opened again, and a copy of the level finds it, in its own tube numbers
+		solution_cache cache {file};
+		auto found {cache.find(variant)};
+		if (!found || found->best.moves.size() != 6 || !variant.is_solved_by(found->best) || found->shortest_solutions != shortest_solutions)
+		{
+			::DebugBreak();
+		}
+		game_state other {{{magenta, orange, orange, magenta}, {orange, magenta, empty, empty}, {empty, empty, empty, empty}}};
+		if (cache.find(other))
 		{
 			::DebugBreak();
 		}
 	}
 
 	{
-		test_tube mid_cream_2_after_empty_2 {1, {cream, cream, empty, empty}};
-		auto [colour, depth] {mid_cream_2_after_empty_2.get_colour_and_depth()};
-		if (colour != cream || depth != 2)
+		// a record cut short, the way a crash in the middle of adding one would leave it, is passed over
+		std::ofstream torn {file, std::ios::binary | std::ios::app};
+		torn << "part of a record";
+	}
+	{
+		solution_cache cache {file};
+		if (cache.size() != 2 || !cache.find(g))
 		{
 			::DebugBreak();
 		}
 	}
+	std::filesystem::remove(file);
 }
 
-void test_pouring_colour()
+void test_work_out_shortest_solutions_breadth_first()
 {
+	auto g {tiny_level()};
+
+	search_options exact;
+	exact.canonicalize_tubes = false;
+	auto solutions {game_state::work_out_shortest_solutions_breadth_first(g, exact)};
+	if (solutions.empty())
 	{
-		test_tube magenta_4 {1, {magenta, magenta, magenta, magenta}};
-		if (magenta_4.pouring_colour() != magenta)
+		::DebugBreak();
+	}
+	for (const auto& solution : solutions)
+	{
+		if (solution.moves.size() != 6 || !g.is_solved_by(solution))
 		{
 			::DebugBreak();
 		}
 	}
 
+	// every shortest solution the depth first search finds is one of the ones rebuilt from the parent edges
+	game_state copy {g};
+	for (const auto& solution : game_state::work_out_all_solutions(copy, exact))
 	{
-		test_tube magenta_3_empty_1 {1, {magenta, magenta, magenta, empty}};
-		if (magenta_3_empty_1.pouring_colour() != magenta)
+		if (std::find(solutions.begin(), solutions.end(), solution) == solutions.end())
 		{
 			::DebugBreak();
 		}
 	}
 
+	// with tube order ignored, the moves still come back in terms of the real tubes
+	for (const auto& solution : game_state::work_out_shortest_solutions_breadth_first(g))
 	{
-		test_tube orange_2_empty_2 {1, {orange, orange, empty, empty}};
-		if (orange_2_empty_2.pouring_colour() != orange)
+		if (solution.moves.size() != 6 || !g.is_solved_by(solution))
 		{
 			::DebugBreak();
 		}
 	}
+}
 
+void test_run_count()
+{
+	if (test_tube {1, {orange, orange, orange, orange}}.run_count() != 1)
 	{
-		test_tube pink_1_empty_3 {1, {pink, empty, empty, empty}};
-		if (pink_1_empty_3.pouring_colour() != pink)
+		::DebugBreak();
+	}
+	if (test_tube {1, {orange, magenta, magenta, empty}}.run_count() != 2)
+	{
+		::DebugBreak();
+	}
+	if (test_tube {1, {orange, magenta, orange, magenta}}.run_count() != 4)
+	{
+		::DebugBreak();
+	}
+	if (test_tube {1, {empty, empty, empty, empty}}.run_count() != 0)
+	{
+		::DebugBreak();
+	}
+}
+
+void test_shortest_solution_dag()
+{
+	auto g {tiny_level()};
+
+	// counted without listing them, but it's the same number, and each index rebuilds the one in that place in the list
+	for (auto canonicalize_tubes : {false, true})
+	{
+		search_options options;
+		options.canonicalize_tubes = canonicalize_tubes;
+		auto dag {game_state::work_out_shortest_solution_dag(g, options)};
+		auto listed {game_state::work_out_shortest_solutions_breadth_first(g, options)};
+		if (dag.length() != 6 || dag.count() != listed.size())
 		{
 			::DebugBreak();
 		}
-		if (pink_1_empty_3.is_empty())
+		for (std::uint64_t i {0}; i < dag.count(); ++i)
 		{
-			::DebugBreak();
+			if (!(dag.solution_at(i) == listed[i]))
+			{
+				::DebugBreak();
+			}
 		}
 	}
 
+	bool threw {false};
+	try
 	{
-		test_tube empty_4 {1, {empty, empty, empty, empty}};
-		if (empty_4.pouring_colour() != empty)
+		static_cast<void>(game_state::work_out_shortest_solution_dag(g).solution_at(1000000));
+	}
+	catch (const std::runtime_error&)
+	{
+		threw = true;
+	}
+	if (!threw)
+	{
+		::DebugBreak();
+	}
+
+	// level_50 has 170 million shortest solutions: the parent edges fit, but listing them gives up at the memory limit,
+	// and so does the search itself when tubes are told apart and there are too many states for the limit
+	search_options limited;
+	limited.memory_limit_bytes = size_t {4} << 20;
+	if (game_state::work_out_shortest_solution_dag(level_50, limited).length() != 29)
+	{
+		::DebugBreak();
+	}
+	auto exact {limited};
+	exact.canonicalize_tubes = false;
+	for (const auto& [listing, search] : {std::pair {true, limited}, std::pair {false, exact}})
+	{
+		try
 		{
+			static_cast<void>(listing ? game_state::work_out_shortest_solutions_breadth_first(level_50, search).size() : game_state::work_out_shortest_solution_dag(level_50, search).count());
 			::DebugBreak();
 		}
-		if (!empty_4.is_empty())
+		catch (const search_interrupted&)
+		{}
+	}
+}
+
+void test_shortest_solution_dag_in_parallel()
+{
+	auto g {tiny_level()};
+
+	// The states are numbered in another order, and how depends on the thread count, but it's the same graph,
+	// so the same number of states, the same length and the same solutions, in some order.
+	for (auto canonicalize_tubes : {false, true})
+	{
+		search_options options;
+		options.canonicalize_tubes = canonicalize_tubes;
+		auto serial {game_state::work_out_shortest_solution_dag(g, options)};
+		auto listed {game_state::work_out_shortest_solutions_breadth_first(g, options)};
+		for (size_t threads : {1, 3, 8})
+		{
+			options.threads = threads;
+			auto dag {game_state::work_out_shortest_solution_dag_in_parallel(g, options)};
+			auto solutions {game_state::work_out_shortest_solutions_breadth_first_in_parallel(g, options)};
+			if (dag.length() != serial.length() || dag.count() != serial.count() || dag.states() != serial.states() || solutions.size() != listed.size())
+			{
+				::DebugBreak();
+			}
+			for (std::uint64_t i {0}; i < dag.count(); ++i)
+			{
+				if (std::find(listed.begin(), listed.end(), dag.solution_at(i)) == listed.end() || !(dag.solution_at(i) == solutions[i]))
+				{
+					::DebugBreak();
+				}
+			}
+		}
+	}
+
+	// and the depth-first search's solutions are all among them
+	search_options exact;
+	exact.canonicalize_tubes = false;
+	exact.threads = 4;
+	auto solutions {game_state::work_out_shortest_solutions_breadth_first_in_parallel(g, exact)};
+	game_state copy {g};
+	for (const auto& solution : game_state::work_out_all_solutions(copy, exact))
+	{
+		if (std::find(solutions.begin(), solutions.end(), solution) == solutions.end())
 		{
 			::DebugBreak();
 		}
+	}
 
+	// the board budget is counted layer by layer before the work is shared out, so it's exact here too
+	search_options short_of_boards;
+	short_of_boards.max_boards_expanded = 3;
+	bool threw {false};
+	try
+	{
+		static_cast<void>(game_state::work_out_shortest_solution_dag_in_parallel(g, short_of_boards));
+	}
+	catch (const search_interrupted&)
+	{
+		threw = true;
+	}
+	if (!threw)
+	{
+		::DebugBreak();
 	}
 }
 
-void test_tube_display()
+void test_work_out_shortest_length_externally()
 {
+	auto work_directory {std::filesystem::temp_directory_path() / "solve-waterflow-tests"};
+	auto g {tiny_level()};
+	if (game_state::work_out_shortest_length_externally(g, work_directory) != 6)
 	{
-		test_tube tube_1 {1, {orange, light_green, magenta, yellow}};
-		std::ostringstream ss;
-		ss << tube_1;
-		if (ss.str() != "{orange, light green, magenta, yellow}")
+		::DebugBreak();
+	}
+
+	// a buffer of a few dozen boards spills runs on every layer, and it has to come to the same length as searching in memory
+	search_options tiny;
+	tiny.memory_limit_bytes = 4096;
+	search_options small;
+	small.transposition_table_bytes = size_t {1} << 20;
+	for (std::uint64_t seed {0}; seed < 10; ++seed)
+	{
+		game_state board {scramble_solved_board(seed, 4, 4, 2, 25)};
+		if (board.is_solved())
+		{
+			continue;
+		}
+		auto length {game_state::work_out_shortest_length_externally(board, work_directory, tiny)};
+		if (!length || *length != game_state::count_solutions_found_in_place(board, small).length)
 		{
 			::DebugBreak();
 		}
 	}
 
+	search_options short_only;
+	short_only.max_solution_length = 5;
+	if (game_state::work_out_shortest_length_externally(g, work_directory, short_only))
 	{
-		test_tube tube_2 {1, {orange, light_green, magenta, empty}};
-		std::ostringstream ss;
-		ss << tube_2;
-		if (ss.str() != "{orange, light green, magenta, empty}")
+		::DebugBreak();
+	}
+	if (!std::filesystem::is_empty(work_directory))
+	{
+		::DebugBreak(); // every search cleans up after itself
+	}
+	std::filesystem::remove(work_directory);
+}
+
+void test_pattern_database()
+{
+	auto file {std::filesystem::temp_directory_path() / "solve-waterflow-tests.pdb"};
+	auto g {tiny_level()};
+
+	for (size_t pattern_colours {1}; pattern_colours <= 2; ++pattern_colours)
+	{
+		pattern_database::build(file, 3, 3, 4, pattern_colours);
+		pattern_database patterns {file};
+		if (!patterns.fits(g) || patterns.lower_bound(g) == 0 || patterns.lower_bound(g) > 6)
+		{
+			::DebugBreak(); // it takes 6 pours, and the bound is never more than that
+		}
+
+		// cutting with it never loses a shortest solution
+		search_options with_patterns;
+		with_patterns.patterns = &patterns;
+		game_state copy {g};
+		if (game_state::work_out_all_solutions_in_place(g, with_patterns) != game_state::work_out_all_solutions_in_place(g) ||
+			game_state::work_out_all_solutions(copy, with_patterns) != game_state::work_out_all_solutions_in_place(g))
 		{
 			::DebugBreak();
 		}
-	}
 
-	{
-		test_tube tube_3 {1, {empty, empty, empty, empty}};
-		std::ostringstream ss;
-		ss << tube_3;
-		if (ss.str() != "{empty, empty, empty, empty}")
+		// a level of another shape is turned away
+		game_state taller {{{magenta, orange, orange, magenta}, {orange, magenta, empty, empty}, {empty, empty, empty, empty}}};
+		try
 		{
+			static_cast<void>(game_state::work_out_all_solutions_in_place(taller, with_patterns));
 			::DebugBreak();
 		}
+		catch (const std::runtime_error&)
+		{}
+	}
+
+	{
+		std::ofstream not_a_database {file, std::ios::binary};
+		not_a_database << "this is not a pattern database, but it's long enough to be one";
+	}
+	try
+	{
+		pattern_database patterns {file};
+		::DebugBreak();
 	}
+	catch (const std::runtime_error&)
+	{}
+	std::filesystem::remove(file);
 }
 
-void test_generate_possible_moves()
+void test_work_out_shortest_solutions_iterative_deepening()
 {
+	auto g {tiny_level()};
+
+	if (g.lower_bound_on_moves_left() > 6)
 	{
-		test_tube source {1, {orange, magenta, yellow, cream}};
-		test_tube dest {2, {orange, magenta, cream, empty}};
-		auto move {source.generate_move_to(dest)};
+		::DebugBreak();
+	}
 
-		if (move.to.tube_index = !1 && move.from.tube_index != 2)
+	// each colour fills two tubes, so solved there are two runs of each, and the bound mustn't count on one: it takes 3 pours, not 4
+	game_state two_tubes_each {{{orange, magenta}, {magenta, magenta}, {orange, orange}, {magenta, orange}, {empty, empty}}};
+	auto three_pours {game_state::work_out_shortest_solutions_iterative_deepening(two_tubes_each)};
+	if (two_tubes_each.lower_bound_on_moves_left() > 3 || three_pours.empty() || three_pours.front().moves.size() != 3)
+	{
+		::DebugBreak();
+	}
+
+	// with tubes of different heights, a colour can finish in more tubes than its pieces over the tallest, so that's no bound.
+	// This one takes a single pour, the dark green in tube 4 into tube 0, and neither it nor any board a few pours from it
+	// can be given a bound past its shortest solution.
+	game_state mixed_heights {{{dark_green, dark_green, dark_green, empty}, {dark_blue}, {light_blue, light_blue, light_blue}, {dark_green},
+		{dark_green, empty, empty}, {dark_blue, dark_blue, dark_blue}, {empty, empty, empty}}};
+	auto board {mixed_heights};
+	for (size_t pours {0}; pours < 8 && !board.is_solved(); ++pours)
+	{
+		auto shortest {game_state::work_out_shortest_solution_dag(board).length()};
+		if (shortest == 0 || board.lower_bound_on_moves_left() > shortest)
 		{
 			::DebugBreak();
 		}
+		std::optional<move> next_move;
+		for (size_t source {0}; source < board.tube_count; ++source)
+		{
+			if (auto destinations {board.test_tubes[source].is_finished() ? std::uint16_t {0} : board.legal_destinations(source)}; destinations != 0)
+			{
+				next_move = board.test_tubes[source].generate_move_to(board.test_tubes[std::countr_zero(destinations)]);
+			}
+		}
+		if (!next_move)
+		{
+			break;
+		}
+		static_cast<void>(board.make_move(*next_move));
+	}
+	auto one_pour {game_state::work_out_shortest_solutions_iterative_deepening(mixed_heights)};
+	if (mixed_heights.lower_bound_on_moves_left() > 1 || one_pour.empty() || one_pour.front().moves.size() != 1)
+	{
+		::DebugBreak();
+	}
 
-		if (move.move_size != 1)
+	search_options every_order;
+	every_order.reduce_move_orders = false;
+	auto solutions {game_state::work_out_shortest_solutions_iterative_deepening(g, every_order)};
+	for (const auto& solution : solutions)
+	{
+		if (solution.moves.size() != 6 || !g.is_solved_by(solution))
 		{
 			::DebugBreak();
 		}
 	}
 
+	// nothing is deduplicated, so it finds every one of the shortest solutions, same as the parent edges hold
+	search_options exact;
+	exact.canonicalize_tubes = false;
+	if (solutions.size() != game_state::work_out_shortest_solutions_breadth_first(g, exact).size())
 	{
-		test_tube source {1, {orange, magenta, yellow, yellow}};
-		test_tube dest {2, {orange, magenta, yellow, empty}};
-		auto move {source.generate_move_to(dest)};
+		::DebugBreak();
+	}
 
-		if (move.to.tube_index = !1 && move.from.tube_index != 2)
+	// skipping undone pours and independent pours in the wrong order still leaves some of them, all just as short
+	auto reduced {game_state::work_out_shortest_solutions_iterative_deepening(g)};
+	if (reduced.empty() || reduced.size() > solutions.size())
+	{
+		::DebugBreak();
+	}
+	for (const auto& solution : reduced)
+	{
+		if (std::find(solutions.begin(), solutions.end(), solution) == solutions.end())
 		{
 			::DebugBreak();
 		}
+	}
+}
 
-		if (move.move_size != 1)
+void test_work_out_all_solutions_in_parallel()
+{
+	auto g {tiny_level()};
+
+	search_options options;
+	options.threads = 4;
+	options.transposition_table_bytes = size_t {1} << 16;
+	auto solutions {game_state::work_out_all_solutions_in_parallel(g, options)};
+	if (solutions.empty())
+	{
+		::DebugBreak();
+	}
+	for (const auto& solution : solutions)
+	{
+		if (solution.moves.size() != 6 || !g.is_solved_by(solution))
 		{
 			::DebugBreak();
 		}
 	}
+}
 
+void test_engines_agree_on_a_bigger_level()
+{
+	auto g {scrambled_level()};
+	search_options small;
+	small.transposition_table_bytes = size_t {1} << 20;
+
+	// the depth-first searches really do drop boards here, and the one that copies boards still finds what the in-place one does
+	search_statistics statistics;
+	auto counted {small};
+	counted.statistics = &statistics;
+	auto in_place {game_state::work_out_all_solutions_in_place(g, counted)};
+	game_state copy {g};
+	if (in_place.empty() || statistics.transposition_hits == 0 || statistics.pruned_by_bound == 0 || game_state::work_out_all_solutions(copy, small) != in_place)
 	{
-		test_tube source {1, {orange, magenta, yellow, empty}};
-		test_tube dest {2, {orange, magenta, yellow, empty}};
-		auto move {source.generate_move_to(dest)};
-
-		if (move.to.tube_index = !1 && move.from.tube_index != 2)
+		::DebugBreak();
+	}
+	const auto length {in_place.front().moves.size()};
+
+	// the parent edges hold every shortest solution: each one the depth-first search finds, and each one IDA* finds trying every order
+	auto exact {small};
+	exact.canonicalize_tubes = false;
+	auto listed {game_state::work_out_shortest_solutions_breadth_first(g, exact)};
+	auto dag {game_state::work_out_shortest_solution_dag(g, exact)};
+	if (listed.empty() || dag.length() != length || dag.count() != listed.size())
+	{
+		::DebugBreak();
+	}
+	for (const auto& solution : in_place)
+	{
+		if (solution.moves.size() != length || !g.is_solved_by(solution) || std::find(listed.begin(), listed.end(), solution) == listed.end())
 		{
 			::DebugBreak();
 		}
+	}
+	auto every_order {exact};
+	every_order.reduce_move_orders = false;
+	if (game_state::work_out_shortest_solutions_iterative_deepening(g, every_order).size() != listed.size())
+	{
+		::DebugBreak();
+	}
+
+	// and every other engine comes to the same length
+	auto parallel {small};
+	parallel.threads = 4;
+	auto in_parallel {game_state::work_out_all_solutions_in_parallel(g, parallel)};
+	auto anytime {game_state::work_out_best_solution_anytime(g, small)};
+	auto work_directory {std::filesystem::temp_directory_path() / "solve-waterflow-tests"};
+	if (in_parallel.empty() || in_parallel.front().moves.size() != length || !g.is_solved_by(in_parallel.front()) ||
+		game_state::work_out_shortest_solution_dag_in_parallel(g, parallel).count() != game_state::work_out_shortest_solution_dag(g, small).count() ||
+		!anytime.best || anytime.best->moves.size() != length || !anytime.proven_shortest ||
+		game_state::work_out_shortest_length_externally(g, work_directory, small) != length)
+	{
+		::DebugBreak();
+	}
+	std::filesystem::remove(work_directory);
+}
+
+void test_parse_level()
+{
+	auto parsed {level::parse("  tiny: magenta, orange, light_green | orange light_green orange | light_green magenta magenta | empty empty empty", "line 1")};
+	if (!parsed || parsed->name != "tiny" || parsed->board.tube_count != 4)
+	{
+		::DebugBreak();
+	}
+	auto expected {tiny_level()};
+	if (parsed->board.hash != expected.hash)
+	{
+		::DebugBreak();
+	}
+
+	auto unnamed {level::parse("dark_blue dark_blue | empty empty", "line 7")};
+	if (!unnamed || unnamed->name != "line 7" || unnamed->board.test_tubes[0].pouring_colour() != dark_blue)
+	{
+		::DebugBreak();
+	}
+
+	if (level::parse("# a comment", "line 1") || level::parse("   ", "line 2"))
+	{
+		::DebugBreak();
+	}
+
+	bool threw {false};
+	try
+	{
+		static_cast<void>(level::parse("dark_blue purple | empty empty", "line 3"));
+	}
+	catch (const std::runtime_error&)
+	{
+		threw = true;
+	}
+	if (!threw)
+	{
+		::DebugBreak();
+	}
+}
 
-		if (move.move_size != 1)
+void test_level_corpus()
+{
+	auto file {std::filesystem::temp_directory_path() / "solve-waterflow-tests.corpus"};
+	std::vector<std::string> lines {
+		"tiny: magenta orange light_green | orange light_green orange | light_green magenta magenta | empty empty empty",
+		"# not a level",
+		"level_50: magenta yellow dark_green orange | yellow dark_blue cream dark_blue | light_blue pink dark_blue light_green | light_blue pink magenta cream | "
+			"yellow light_blue magenta dark_blue | yellow light_green light_green light_green | cream pink dark_green light_blue | pink orange dark_green orange | "
+			"cream dark_green orange magenta | empty empty empty empty | empty empty empty empty",
+		"short: pink pink | pink empty empty"};
+	auto write {[&](const std::vector<std::string>& levels) {
+		std::stringstream text;
+		for (const auto& line : levels)
 		{
-			::DebugBreak();
+			text << line << "\n";
 		}
-	}
+		level_corpus::write(file, text);
+	}};
 
+	write(lines);
 	{
-		test_tube source {1, {orange, magenta, yellow, yellow}};
-		test_tube dest {2, {orange, yellow, empty, empty}};
-		auto move {source.generate_move_to(dest)};
-
-		if (move.to.tube_index = !1 && move.from.tube_index != 2)
+		level_corpus corpus {file};
+		if (corpus.size() != 3)
 		{
 			::DebugBreak();
 		}
-
-		if (move.move_size != 2)
+		for (size_t i {0}; i < corpus.size(); ++i)
+		{
+			// every board comes back the same as the line it was made from
+			auto expected {level::parse(lines[i == 0 ? 0 : i + 1], "")->board};
+			auto board {corpus.board(i)};
+			if (board.tube_count != expected.tube_count || board.hash != expected.hash || board.tube_order_free_hash != expected.tube_order_free_hash)
+			{
+				::DebugBreak();
+			}
+			for (size_t t {0}; t < board.tube_count; ++t)
+			{
+				if (board.test_tubes[t].contents != expected.test_tubes[t].contents || board.test_tubes[t].capacity != expected.test_tubes[t].capacity)
+				{
+					::DebugBreak();
+				}
+			}
+		}
+		search_options small;
+		small.transposition_table_bytes = size_t {1} << 20;
+		if (game_state::count_solutions_found_in_place(corpus.board(0), small).length != 6)
 		{
 			::DebugBreak();
 		}
 	}
 
+	// a level with a colour that can't fill its tubes is turned away when the corpus is opened
+	write({lines[0], "odd: magenta magenta | magenta empty | orange orange"});
+	try
 	{
-		test_tube source {1, {orange, magenta, magenta, yellow}};
-		test_tube dest {2, {empty, empty, empty, empty}};
-		auto move {source.generate_move_to(dest)};
-
-		if (move.to.tube_index = !1 && move.from.tube_index != 2)
+		level_corpus corpus {file};
+		::DebugBreak();
+	}
+	catch (const std::runtime_error& e)
+	{
+		if (std::string {e.what()}.find("has 3 of magenta, which doesn't fill tubes of 2") == std::string::npos)
 		{
-			::DebugBreak();
+			::DebugBreak(); // the colour is named, not numbered
 		}
+	}
 
-		if (move.move_size != 1)
+	// and so is a colour that isn't one
+	write({lines[0]});
+	{
+		std::fstream patch {file, std::ios::binary | std::ios::in | std::ios::out};
+		patch.seekp(-1, std::ios::end);
+		patch.put(static_cast<char>(0xf0));
+	}
+	try
+	{
+		level_corpus corpus {file};
+		::DebugBreak();
+	}
+	catch (const std::runtime_error&)
+	{}
+	std::filesystem::remove(file);
+}
+
+void test_solver_daemon()
+{
+	auto request {[](std::uint32_t id, const std::string& level) {
+		std::string frame;
+		put_little_endian(frame, id, 4);
+		return frame + level;
+	}};
+	std::stringstream requests;
+	write_frame(requests, request(1, "magenta orange light_green | orange light_green orange | light_green magenta magenta | empty empty empty"));
+	write_frame(requests, request(2, "purple | empty"));
+	write_frame(requests, request(3, "pink pink | empty empty"));
+	write_frame(requests, request(4, "orange magenta light_green | magenta light_green magenta | light_green orange orange | empty empty empty"));
+	write_frame(requests, "no");
+
+	daemon_options options;
+	options.threads = 2;
+	options.queue_length = 1; // so reading has to wait for the workers
+	options.memory_limit_bytes = size_t {1} << 20;
+	std::stringstream replies;
+	{
+		solver_daemon daemon {options};
+		serve_stream(requests, replies, daemon);
+	}
+
+	std::unordered_map<std::uint64_t, std::string> by_id;
+	while (auto reply {read_frame(replies)})
+	{
+		if (reply->size() < 5)
 		{
 			::DebugBreak();
 		}
+		by_id[get_little_endian(*reply, 0, 4)] = reply->substr(4);
 	}
-
+	if (by_id.size() != 5 || by_id[2][0] != static_cast<char>(reply_status::error) || by_id[3][0] != static_cast<char>(reply_status::already_solved) ||
+		by_id[0][0] != static_cast<char>(reply_status::error))
 	{
-		test_tube source {1, {orange, magenta, yellow, cream}};
-		test_tube dest {2, {empty, empty, empty, empty}};
-		auto move {source.generate_move_to(dest)};
+		::DebugBreak();
+	}
 
-		if (move.to.tube_index = !1 && move.from.tube_index != 2)
+	// the two solved levels come back with 6 pours that solve them, from workers whose tables were used before
+	auto tiny {tiny_level()};
+	game_state swapped {{{orange, magenta, light_green}, {magenta, light_green, magenta}, {light_green, orange, orange}, {empty, empty, empty}}};
+	for (auto [id, board] : {std::pair {1, tiny}, std::pair {4, swapped}})
+	{
+		const auto& reply {by_id[id]};
+		if (reply[0] != static_cast<char>(reply_status::shortest) || get_little_endian(reply, 1, 2) != 6 || reply.size() != 3 + 6 * 2)
 		{
 			::DebugBreak();
 		}
-
-		if (move.move_size != 1)
+		std::vector<move> moves;
+		for (size_t i {0}; i < 6; ++i)
+		{
+			packed_move packed;
+			packed.bits = static_cast<std::uint16_t>(get_little_endian(reply, 3 + i * 2, 2));
+			moves.push_back(packed.unpack());
+		}
+		if (!board.is_solved_by(moves))
 		{
 			::DebugBreak();
 		}
 	}
 }
 
-void test_work_out_all_solutions_1()
+void test_scramble_solved_board()
 {
-	game_state g
-	{{
-	{yellow, empty},
-	{yellow, empty}
-	}};
-
-	auto solutions {game_state::work_out_all_solutions(g)};
-
-	const solution solution_1 {{{1, 0, 1}}};
-	const solution solution_2 {{{0, 1, 1}}};
-
-	auto found_solution_1 {std::find(solutions.begin(), solutions.end(), solution_1)};
-	if (*found_solution_1 != solution_1)
+	auto tubes {scramble_solved_board(42, 4, 4, 2, 12)};
+	if (tubes != scramble_solved_board(42, 4, 4, 2, 12) || tubes.size() != 6)
 	{
-		::DebugBreak();
+		::DebugBreak(); // a seed always makes the same level
 	}
 
-	auto found_solution_2 {std::find(solutions.begin(), solutions.end(), solution_2)};
-	if (*found_solution_2 != solution_2)
+	game_state board {tubes};
+	if (!board.is_solved())
 	{
-		::DebugBreak();
+		// it was scrambled with 12 pours backwards, so it can't take more than 12 to solve
+		search_options options;
+		options.transposition_table_bytes = size_t {1} << 16;
+		auto solutions {game_state::work_out_all_solutions_in_place(board, options)};
+		if (solutions.empty() || solutions.front().moves.size() > 12 || !board.is_solved_by(solutions.front()))
+		{
+			::DebugBreak();
+		}
 	}
+}
 
-	if (solutions.size() != 2)
+void test_legal_destinations()
+{
+	// the one-at-a-time version is the definition, so the vectorized one has to agree with it on every tube of every board,
+	// including boards it has poured its way to
+	for (std::uint64_t seed {0}; seed < 50; ++seed)
 	{
-		::DebugBreak();
+		game_state board {scramble_solved_board(seed, 1 + seed % 9, 2 + seed % 5, 1 + seed % 3, 30)};
+		for (size_t pours {0}; pours < 10; ++pours)
+		{
+			std::optional<move> next_move;
+			for (size_t source {0}; source < board.tube_count; ++source)
+			{
+				if (board.test_tubes[source].is_finished())
+				{
+					continue;
+				}
+				auto destinations {board.legal_destinations(source)};
+				if (destinations != board.legal_destinations_one_by_one(source))
+				{
+					::DebugBreak();
+				}
+				if (destinations != 0)
+				{
+					next_move = board.test_tubes[source].generate_move_to(board.test_tubes[std::countr_zero(destinations)]);
+				}
+			}
+			if (!next_move)
+			{
+				break;
+			}
+			static_cast<void>(board.make_move(*next_move));
+		}
 	}
 }
 
-void test_work_out_all_solutions_2()
+void test_game_state_has_already_been_examined()
 {
 	game_state g
 	{{
-	{yellow, yellow, empty},
-	{yellow, empty, empty},
+	{magenta, orange, light_green},
+	{orange, light_green, orange},
+	{light_green, magenta, magenta},
+	{empty, empty, empty}
 	}};
 
-	auto solutions {game_state::work_out_all_solutions(g)};
+	transposition_table examined_boards {size_t {1} << 10};
 
-	const solution solution_1 {{{0, 1, 2}}};
-	const solution solution_2 {{{1, 0, 1}}};
+	if (game_state_has_already_been_examined(examined_boards, g, 10)) // first time we've seen it
+	{
+		::DebugBreak();
+	}
 
-	auto found_solution_1 {std::find(solutions.begin(), solutions.end(), solution_1)};
-	if (*found_solution_1 != solution_1)
+	if (!game_state_has_already_been_examined(examined_boards, g, 10)) // the state has the same depth
 	{
 		::DebugBreak();
 	}
 
-	auto found_solution_2 {std::find(solutions.begin(), solutions.end(), solution_2)};
-	if (*found_solution_2 != solution_2)
+	if (!game_state_has_already_been_examined(examined_boards, g, 11)) // the path to the state is worse
 	{
 		::DebugBreak();
 	}
 
-	if (solutions.size() != 2)
+	if (game_state_has_already_been_examined(examined_boards, g, 9)) // the path to the state is shorter
 	{
 		::DebugBreak();
 	}
-}
 
-void test_work_out_all_solutions_3()
-{
-	game_state g
+	game_state g2
 	{{
-	{yellow, yellow, empty},
-	{yellow, empty, empty},
+	{magenta, orange, light_green},
+	{orange, light_green, orange},
+	{light_green, magenta, pink},
 	{empty, empty, empty}
 	}};
 
-	auto solutions {game_state::work_out_all_solutions(g)};
-
-	const solution solution_1 {{{1, 0, 2}}};
-	const solution solution_2 {{{0, 1, 1}}};
-
-	std::vector<solution> expected_solutions {solution_1, solution_2};
-	for (const auto& solution : solutions)
-	{
-		auto found_solution {std::find(solutions.begin(), solutions.end(), solution)};
-		if (found_solution == solutions.end())
-		{
-			::DebugBreak();
-		}
-	}
-
-	if (solutions.size() != expected_solutions.size())
+	if (game_state_has_already_been_examined(examined_boards, g2, 0)) // first time
 	{
 		::DebugBreak();
 	}
 }
 
-void test_work_out_all_solutions_4()
+void test_canonical_form()
 {
-	game_state g
+	auto g {tiny_level()};
+
+	game_state tubes_shuffled
 	{{
-	{magenta, orange, light_green},
-	{orange, light_green, orange},
+	{empty, empty, empty},
 	{light_green, magenta, magenta},
-	{empty, empty, empty}
+	{magenta, orange, light_green},
+	{orange, light_green, orange}
 	}};
-	// oh boy these get big real quick
 
-	auto solutions {game_state::work_out_all_solutions(g)};
+	game_state colours_swapped
+	{{
+	{yellow, orange, pink},
+	{orange, pink, orange},
+	{pink, yellow, yellow},
+	{empty, empty, empty}
+	}};
 
-	const solution solution_1 {{{2, 3, 2}, {0, 2, 1}, {1, 0, 1}, {1, 2, 1}, {0, 1, 2}, {0, 3, 1}}};
-	const solution solution_2 {{{2, 3, 2}, {0, 2, 1}, {1, 0, 1}, {1, 2, 1}, {0, 1, 2}, {3, 0, 2}}};
+	if (g.canonical_form().hash() != tubes_shuffled.canonical_form().hash() || g.tube_order_free_hash != tubes_shuffled.tube_order_free_hash)
+	{
+		::DebugBreak();
+	}
 
-	const solution solution_3 {{{1, 3, 1}, {0, 1, 1}, {0, 3, 1}, {2, 0, 2}, {1, 2, 2}, {3, 1, 2}}};
-	const solution solution_4 {{{1, 3, 1}, {0, 1, 1}, {0, 3, 1}, {2, 0, 2}, {1, 2, 2}, {1, 3, 1}}};
+	if (g.canonical_form().hash() != colours_swapped.canonical_form().hash())
+	{
+		::DebugBreak();
+	}
 
-	const solution solution_5 {{{0, 3, 1}, {1, 0, 1}, {1, 3, 1}, {0, 1, 2}, {2, 0, 2}, {3, 2, 2}}}; // lol, computer generated
-	const solution solution_6 {{{0, 3, 1}, {1, 0, 1}, {1, 3, 1}, {0, 1, 2}, {2, 0, 2}, {2, 3, 1}}}; // lol, computer generated
+	if (g.hash == tubes_shuffled.hash) // the exact hash still tells them apart
+	{
+		::DebugBreak();
+	}
 
-	std::vector<solution> expected_solutions {solution_1, solution_2, solution_3, solution_4, solution_5, solution_6};
-	for (const auto& solution : solutions)
+	auto canonical {colours_swapped.canonical_form()};
+	for (size_t i {0}; i < canonical.tube_count; ++i)
 	{
-		auto found_solution {std::find(solutions.begin(), solutions.end(), solution)};
-		if (found_solution == solutions.end())
+		const auto& real_tube {colours_swapped.tubes()[canonical.real_tube_index[i]]};
+		for (size_t slot {0}; slot < real_tube.capacity; ++slot)
 		{
-			::DebugBreak();
+			auto canonical_colour {(canonical.contents[i] >> (slot * bits_per_slot)) & slot_mask};
+			if (canonical_colour != empty && canonical.real_colour[canonical_colour] != real_tube.colour_at(slot))
+			{
+				::DebugBreak();
+			}
 		}
 	}
 
-	if (solutions.size() != expected_solutions.size())
+	auto real_move {canonical.to_real_move({0, 1, 1})};
+	if (real_move.from.tube_index != canonical.real_tube_index[0] || real_move.to.tube_index != canonical.real_tube_index[1])
 	{
 		::DebugBreak();
 	}
 }
 
-void test_work_out_all_solutions()
-{
-	test_work_out_all_solutions_1();
-	test_work_out_all_solutions_2();
-	test_work_out_all_solutions_3();
-	test_work_out_all_solutions_4();
-}
-
-void test_game_state_has_already_been_examined()
+void test_transposition_table()
 {
-	game_state g
-	{{
-	{magenta, orange, light_green},
-	{orange, light_green, orange},
-	{light_green, magenta, magenta},
-	{empty, empty, empty}
-	}};
-
-	std::map<std::string, size_t> examined_boards;
+	transposition_table table {64 * 16}; // 16 buckets
+	auto size_before {table.size_in_bytes()};
 
-	if (game_state_has_already_been_examined(examined_boards, g, 10)) // first time we've seen it
+	if (table.has_already_been_examined(0, 1)) // the shallow one we want to keep
 	{
 		::DebugBreak();
 	}
 
-	if (!game_state_has_already_been_examined(examined_boards, g, 10)) // the state has the same depth
+	for (std::uint64_t key {16}; key < 16 * 100; key += 16) // every one of these lands in the same bucket
+	{
+		static_cast<void>(table.has_already_been_examined(key, 5));
+	}
+
+	if (table.size_in_bytes() != size_before) // the table never grows
 	{
 		::DebugBreak();
 	}
 
-	if (!game_state_has_already_been_examined(examined_boards, g, 11)) // the path to the state is worse
+	if (!table.has_already_been_examined(0, 1)) // the deeper entries were replaced instead
 	{
 		::DebugBreak();
 	}
 
-	if (game_state_has_already_been_examined(examined_boards, g, 9)) // the path to the state is shorter
+	if (table.clear().has_already_been_examined(0, 1) || !table.has_already_been_examined(0, 1)) // cleared, it's as good as new
 	{
 		::DebugBreak();
 	}
+}
 
-	game_state g2
-	{{
-	{magenta, orange, light_green},
-	{orange, light_green, orange},
-	{light_green, magenta, pink},
-	{empty, empty, empty}
-	}};
+}
 
-	if (game_state_has_already_been_examined(examined_boards, g2, 0)) // first time
+int pattern_database_main(const std::vector<std::string>& arguments)
+{
+	// solve-waterflow --build-pattern-database file [--colours n] [--height n] [--tubes n] [--pattern-colours n]
+	std::filesystem::path file;
+	size_t colours {7};
+	size_t capacity {4};
+	size_t tubes {9};
+	size_t pattern_colours {1};
+	try
 	{
-		::DebugBreak();
+		size_t i {0};
+		file = text_after(arguments, i);
+		for (++i; i < arguments.size(); ++i)
+		{
+			const auto& argument {arguments[i]};
+			auto number {[&] { return number_after(arguments, i); }};
+
+			if (argument == "--colours")
+			{
+				colours = number();
+			}
+			else if (argument == "--height")
+			{
+				capacity = number();
+			}
+			else if (argument == "--tubes")
+			{
+				tubes = number();
+			}
+			else if (argument == "--pattern-colours")
+			{
+				pattern_colours = number();
+			}
+			else
+			{
+				throw std::runtime_error("don't know " + argument);
+			}
+		}
+		pattern_database::build(file, colours, capacity, tubes, pattern_colours);
+		std::cout << std::format("{}: {} boards", file.string(), pattern_database {file}.built_for().boards) << std::endl;
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		std::cerr << "usage: solve-waterflow --build-pattern-database file [--colours n] [--height n] [--tubes n] [--pattern-colours n]" << std::endl;
+		return 1;
 	}
+	return 0;
 }
 
+int corpus_main(const std::vector<std::string>& arguments)
+{
+	// solve-waterflow --make-corpus corpus [file]
+	// packs the levels in the file, or on stdin when there's no file or it's -, into a level corpus
+	if (arguments.size() < 2 || arguments.size() > 3)
+	{
+		std::cerr << "usage: solve-waterflow --make-corpus corpus [file]" << std::endl;
+		return 1;
+	}
+	try
+	{
+		if (arguments.size() == 2 || arguments[2] == "-")
+		{
+			level_corpus::write(arguments[1], std::cin);
+			return 0;
+		}
+		std::ifstream file {arguments[2]};
+		if (!file)
+		{
+			throw std::runtime_error("can't open " + arguments[2]);
+		}
+		level_corpus::write(arguments[1], file);
+		return 0;
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+	std::vector<std::string> arguments {argv + 1, argv + argc};
+	if (!arguments.empty() && arguments[0] == "--batch")
+	{
+		return batch_main(arguments);
+	}
+	if (!arguments.empty() && arguments[0] == "--benchmark")
+	{
+		return benchmark_main(arguments);
+	}
+	if (!arguments.empty() && arguments[0] == "--build-pattern-database")
+	{
+		return pattern_database_main(arguments);
+	}
+	if (!arguments.empty() && arguments[0] == "--daemon")
+	{
+		return daemon_main(arguments);
+	}
+	if (!arguments.empty() && arguments[0] == "--make-corpus")
+	{
+		return corpus_main(arguments);
+	}
+
 	tests::test_get_colour_and_depth();
 	tests::test_pouring_colour();
+	tests::test_run_count();
 	tests::test_tube_display();
 	tests::test_generate_possible_moves();
+	tests::test_legal_destinations();
 	tests::test_game_state_has_already_been_examined();
+	tests::test_transposition_table();
+	tests::test_canonical_form();
 	tests::test_work_out_all_solutions();
+	tests::test_work_out_all_solutions_in_place();
+	tests::test_stream_solutions_in_place();
+	tests::test_safe_moves();
+	tests::test_with_fixed_tube_count();
+	tests::test_search_statistics();
+	tests::test_anytime_solving();
+	tests::test_solution_cache();
+	tests::test_work_out_shortest_solutions_breadth_first();
+	tests::test_shortest_solution_dag();
+	tests::test_shortest_solution_dag_in_parallel();
+	tests::test_work_out_shortest_solutions_iterative_deepening();
+	tests::test_work_out_shortest_length_externally();
+	tests::test_pattern_database();
+	tests::test_work_out_all_solutions_in_parallel();
+	tests::test_engines_agree_on_a_bigger_level();
+	tests::test_parse_level();
+	tests::test_level_corpus();
+	tests::test_solver_daemon();
+	tests::test_scramble_solved_board();
 
 	//tests::test_work_out_all_solutions_3();
 